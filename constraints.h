@@ -0,0 +1,561 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_CONSTRAINTS_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_CONSTRAINTS_H
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./tsptw_data_dt.h"
+
+#include "ortools/constraint_solver/constraint_solver.h"
+#include "ortools/constraint_solver/routing.h"
+
+namespace operations_research {
+
+enum LinkedActivity { FreeActivity = 2, EqualActivity = 1, ChainedActivity = 0 };
+enum LinkedVehicles { DifferentVehicles = 1, SameVehicle = 0 };
+enum DayLapse { SameDay = 2, MaximumLapse = 1, MinimumLapse = 0 };
+
+//  Loads of every capacity unit along a route in a single pass, from flat per
+//  node quantities. Loads follow the quantity dimensions semantics: they never
+//  get negative and only starts and refill services may raise them.
+class VectorCapacity : public BaseObject {
+public:
+  VectorCapacity(const TSPTWDataDT& data, const RoutingIndexManager& manager)
+      : data_(data)
+      , manager_(manager)
+      , units_(data.Vehicles().at(0)->capacity.size())
+      , has_counting_(false) {
+    const int size = data.Size();
+    quantities_.assign(size * units_, 0);
+    setup_quantities_.assign(size * units_, 0);
+    refills_.assign(size * units_, false);
+    for (int i = 0; i < size; ++i) {
+      const RoutingIndexManager::NodeIndex node(i);
+      const std::vector<int64> quantities       = data.Quantities(node);
+      const std::vector<int64>& setups          = data.SetupQuantities(node);
+      const std::vector<bool> refill_quantities = data.RefillQuantities(node);
+      for (std::size_t unit = 0; unit < units_; ++unit) {
+        if (unit < quantities.size())
+          quantities_[i * units_ + unit] = quantities[unit];
+        if (unit < setups.size() && data.Vehicles().at(0)->counting.at(unit))
+          setup_quantities_[i * units_ + unit] = setups[unit];
+        if (unit < refill_quantities.size())
+          refills_[i * units_ + unit] = refill_quantities[unit];
+      }
+    }
+    for (std::size_t unit = 0; unit < units_; ++unit)
+      has_counting_ = has_counting_ || data.Vehicles().at(0)->counting.at(unit);
+  }
+
+  std::size_t Units() const { return units_; }
+
+  //  False when a hard capacity is exceeded along the route, given as routing
+  //  indices from the vehicle start to its end. Otherwise sets the overload cost.
+  bool Evaluate(int vehicle, const std::vector<int64>& route, int64* overload_cost) const {
+    const TSPTWDataDT::Vehicle* data_vehicle = data_.Vehicles().at(vehicle);
+    const std::size_t size                   = route.size();
+    transits_.resize(size * units_);
+    needs_.assign(size * units_, 0);
+
+    for (std::size_t position = 0; position + 1 < size; ++position) {
+      const RoutingIndexManager::NodeIndex node = manager_.IndexToNode(route[position]);
+      const bool leaves =
+          has_counting_ &&
+          data_.LeavesLocation(node, manager_.IndexToNode(route[position + 1]));
+      const int64* quantities = &quantities_[node.value() * units_];
+      const int64* setups     = &setup_quantities_[node.value() * units_];
+      int64* transits         = &transits_[position * units_];
+      for (std::size_t unit = 0; unit < units_; ++unit)
+        transits[unit] = quantities[unit] - (leaves ? setups[unit] : 0);
+    }
+
+    // Loads needed at each position to keep the following ones positive
+    for (std::size_t position = size - 1; position-- > 0;) {
+      const int node = manager_.IndexToNode(route[position]).value();
+      for (std::size_t unit = 0; unit < units_; ++unit) {
+        if (position > 0 && !refills_[node * units_ + unit])
+          needs_[position * units_ + unit] =
+              std::max<int64>(0, needs_[(position + 1) * units_ + unit] -
+                                     transits_[position * units_ + unit]);
+      }
+    }
+
+    loads_.assign(needs_.begin(), needs_.begin() + units_);
+    for (std::size_t position = 1; position < size; ++position) {
+      const int node = manager_.IndexToNode(route[position - 1]).value();
+      for (std::size_t unit = 0; unit < units_; ++unit) {
+        loads_[unit] += transits_[(position - 1) * units_ + unit];
+        if (position == 1 || refills_[node * units_ + unit])
+          loads_[unit] = std::max(loads_[unit], needs_[position * units_ + unit]);
+        if (data_vehicle->capacity[unit] >= 0 &&
+            data_vehicle->overload_multiplier[unit] == 0 &&
+            loads_[unit] > data_vehicle->capacity[unit])
+          return false;
+      }
+    }
+
+    *overload_cost = 0;
+    for (std::size_t unit = 0; unit < units_; ++unit) {
+      if (data_vehicle->capacity[unit] >= 0 && data_vehicle->overload_multiplier[unit] > 0)
+        *overload_cost += std::max<int64>(0, loads_[unit] - data_vehicle->capacity[unit]) *
+                          data_vehicle->overload_multiplier[unit];
+    }
+    return true;
+  }
+
+  std::string DebugString() const override { return "VectorCapacity"; }
+
+private:
+  const TSPTWDataDT& data_;
+  const RoutingIndexManager& manager_;
+  const std::size_t units_;
+  bool has_counting_;
+  std::vector<int64> quantities_;
+  std::vector<int64> setup_quantities_;
+  std::vector<bool> refills_;
+  mutable std::vector<int64> transits_;
+  mutable std::vector<int64> needs_;
+  mutable std::vector<int64> loads_;
+};
+
+namespace {
+
+//  Links the nodes of a relation group as a whole:
+//  - ChainedActivity: a node is active only if the previous one is,
+//    EqualActivity: all nodes are active or none is;
+//  - SameVehicle: all active nodes are served by the same vehicle,
+//    DifferentVehicles: consecutive active nodes are served by different ones;
+//  - direct_successors: an active node directly follows the previous active one.
+//  Propagation only wakes up on the variables bound by the search.
+class LinkedNodesConstraint : public Constraint {
+public:
+  LinkedNodesConstraint(const RoutingModel& routing, const std::vector<int64>& indices,
+                        LinkedActivity activity, LinkedVehicles vehicles,
+                        bool direct_successors)
+      : Constraint(routing.solver())
+      , routing_(routing)
+      , indices_(indices)
+      , activity_(activity)
+      , vehicles_(vehicles)
+      , direct_successors_(direct_successors) {}
+
+  void Post() override {
+    for (std::size_t k = 0; k < indices_.size(); ++k) {
+      Demon* const demon = MakeConstraintDemon1(
+          solver(), this, &LinkedNodesConstraint::PropagateNode, "PropagateNode", k);
+      routing_.ActiveVar(indices_[k])->WhenBound(demon);
+      routing_.VehicleVar(indices_[k])->WhenBound(demon);
+      if (direct_successors_)
+        routing_.NextVar(indices_[k])->WhenBound(demon);
+    }
+  }
+
+  void InitialPropagate() override {
+    for (std::size_t k = 0; k < indices_.size(); ++k)
+      PropagateNode(k);
+  }
+
+  std::string DebugString() const override { return "LinkedNodesConstraint"; }
+
+private:
+  IntVar* Active(std::size_t k) const { return routing_.ActiveVar(indices_[k]); }
+
+  IntVar* Vehicle(std::size_t k) const { return routing_.VehicleVar(indices_[k]); }
+
+  void PropagateNode(std::size_t k) {
+    PropagateActivity(k);
+    PropagateVehicle(k);
+    if (direct_successors_) {
+      if (k > 0)
+        PropagateSuccessor(k - 1);
+      PropagateSuccessor(k);
+    }
+  }
+
+  void PropagateActivity(std::size_t k) {
+    if (!Active(k)->Bound() || activity_ == FreeActivity)
+      return;
+    const int64 active = Active(k)->Value();
+    for (std::size_t j = 0; j < indices_.size(); ++j) {
+      if (activity_ == EqualActivity || (active == 1 && j < k) || (active == 0 && j > k))
+        Active(j)->SetValue(active);
+    }
+  }
+
+  void PropagateVehicle(std::size_t k) {
+    int64 vehicle = Vehicle(k)->Bound() ? Vehicle(k)->Value() : -1;
+    if (vehicles_ == DifferentVehicles) {
+      if (vehicle < 0)
+        return;
+      if (k > 0)
+        Vehicle(k - 1)->RemoveValue(vehicle);
+      if (k + 1 < indices_.size())
+        Vehicle(k + 1)->RemoveValue(vehicle);
+      return;
+    }
+
+    // An active node takes the vehicle of any routed node of the group
+    if (vehicle < 0) {
+      if (Active(k)->Min() == 0)
+        return;
+      for (std::size_t j = 0; j < indices_.size() && vehicle < 0; ++j) {
+        if (Vehicle(j)->Bound())
+          vehicle = Vehicle(j)->Value();
+      }
+      if (vehicle < 0)
+        return;
+    }
+    for (std::size_t j = 0; j < indices_.size(); ++j) {
+      if (Active(j)->Min() == 1)
+        Vehicle(j)->SetValue(vehicle);
+      else if (!Vehicle(j)->Bound())
+        Vehicle(j)->SetValues({-1, vehicle});
+    }
+  }
+
+  //  Between the nodes k and k + 1
+  void PropagateSuccessor(std::size_t k) {
+    if (k + 1 >= indices_.size() || Active(k)->Min() == 0)
+      return;
+    IntVar* const next = routing_.NextVar(indices_[k]);
+    if (Active(k + 1)->Min() == 1)
+      next->SetValue(indices_[k + 1]);
+    else if (!next->Contains(indices_[k + 1]))
+      Active(k + 1)->SetValue(0);
+  }
+
+  const RoutingModel& routing_;
+  const std::vector<int64> indices_;
+  const LinkedActivity activity_;
+  const LinkedVehicles vehicles_;
+  const bool direct_successors_;
+};
+
+//  Bounds the days of the vehicles serving two consecutive nodes of a relation,
+//  when both are active:
+//  - MinimumLapse: vehicle(current) >= first vehicle of day(previous) + lapse,
+//  - MaximumLapse: vehicle(previous) <= vehicle(current) <= first vehicle of
+//    day(previous) + lapse,
+//  - SameDay: day(previous) == day(current), an inactive node having day -1.
+//  Vehicles are sorted by day, so the vehicle domains are reduced with bounds
+//  looked up in the vehicle to day and day to first vehicle tables.
+class DayLapseConstraint : public Constraint {
+public:
+  DayLapseConstraint(const RoutingModel& routing, int64 previous, int64 current,
+                     const std::vector<int>& vehicle_days,
+                     const std::vector<int64>& day_first_vehicles, int64 lapse,
+                     DayLapse type)
+      : Constraint(routing.solver())
+      , previous_active_(routing.ActiveVar(previous))
+      , current_active_(routing.ActiveVar(current))
+      , previous_vehicle_(routing.VehicleVar(previous))
+      , current_vehicle_(routing.VehicleVar(current))
+      , vehicle_days_(vehicle_days)
+      , day_first_vehicles_(day_first_vehicles)
+      , lapse_(lapse)
+      , type_(type) {}
+
+  void Post() override {
+    Demon* const demon = solver()->MakeConstraintInitialPropagateCallback(this);
+    previous_active_->WhenBound(demon);
+    current_active_->WhenBound(demon);
+    previous_vehicle_->WhenRange(demon);
+    current_vehicle_->WhenRange(demon);
+  }
+
+  void InitialPropagate() override {
+    if (type_ == SameDay) {
+      current_vehicle_->SetRange(First(Day(previous_vehicle_->Min())),
+                                 Last(Day(previous_vehicle_->Max())));
+      previous_vehicle_->SetRange(First(Day(current_vehicle_->Min())),
+                                  Last(Day(current_vehicle_->Max())));
+      return;
+    }
+
+    const int64 previous_min = std::max<int64>(previous_vehicle_->Min(), 0);
+    const int64 current_min  = std::max<int64>(current_vehicle_->Min(), 0);
+    int64 current_lower, current_upper, previous_lower, previous_upper;
+    if (type_ == MinimumLapse) {
+      current_lower  = First(Day(previous_min) + lapse_);
+      current_upper  = current_vehicle_->Max();
+      previous_lower = previous_min;
+      previous_upper = Last(Day(current_vehicle_->Max()) - lapse_);
+    } else {
+      // Smallest day whose first vehicle is not before the current one
+      const int64 current_day = First(Day(current_min)) == current_min
+                                    ? Day(current_min)
+                                    : Day(current_min) + 1;
+      current_lower  = previous_min;
+      current_upper  = First(Day(previous_vehicle_->Max()) + lapse_);
+      previous_lower = First(current_day - lapse_);
+      previous_upper = current_vehicle_->Max();
+    }
+
+    if (previous_active_->Min() == 1 && current_active_->Min() == 1) {
+      current_vehicle_->SetRange(current_lower, current_upper);
+      previous_vehicle_->SetRange(previous_lower, previous_upper);
+    } else if (previous_active_->Min() == 1 &&
+               (current_vehicle_->Max() < current_lower ||
+                current_min > current_upper)) {
+      current_active_->SetValue(0);
+    }
+  }
+
+  std::string DebugString() const override { return "DayLapseConstraint"; }
+
+private:
+  int64 Day(int64 vehicle) const {
+    if (vehicle < 0)
+      return -1;
+    return vehicle_days_[std::min<int64>(vehicle, vehicle_days_.size() - 1)];
+  }
+
+  //  First vehicle of the day, none after the last day
+  int64 First(int64 day) const {
+    if (day < 0)
+      return -1;
+    if (day >= static_cast<int64>(day_first_vehicles_.size()))
+      return kint64max;
+    return day_first_vehicles_[day];
+  }
+
+  //  Last vehicle of the day or of the days before
+  int64 Last(int64 day) const {
+    if (day < 0)
+      return -1;
+    if (day + 1 >= static_cast<int64>(day_first_vehicles_.size()))
+      return vehicle_days_.size() - 1;
+    return day_first_vehicles_[day + 1] - 1;
+  }
+
+  IntVar* const previous_active_;
+  IntVar* const current_active_;
+  IntVar* const previous_vehicle_;
+  IntVar* const current_vehicle_;
+  const std::vector<int>& vehicle_days_;
+  const std::vector<int64>& day_first_vehicles_;
+  const int64 lapse_;
+  const DayLapse type_;
+};
+
+//  Checks the loads of the routes fully assigned, and sets the overload cost of
+//  their vehicle on its overload variable when there is one. Only the routes
+//  through the nexts bound since the last check are walked.
+class VectorCapacityConstraint : public Constraint {
+  enum { kUnwalked = -2, kUnreached = -1 };
+
+public:
+  VectorCapacityConstraint(const RoutingModel& routing, const VectorCapacity* capacity,
+                           const std::vector<IntVar*>& overloads)
+      : Constraint(routing.solver())
+      , routing_(routing)
+      , capacity_(capacity)
+      , overloads_(overloads)
+      , check_demon_(nullptr)
+      , checked_(routing.vehicles(), false)
+      , reached_(routing.Size(), kUnwalked) {}
+
+  void Post() override {
+    check_demon_ = MakeDelayedConstraintDemon0(
+        solver(), this, &VectorCapacityConstraint::CheckBoundRoutes, "CheckBoundRoutes");
+    for (int64 index = 0; index < routing_.Size(); ++index) {
+      Demon* const demon = MakeConstraintDemon1(
+          solver(), this, &VectorCapacityConstraint::NextBound, "NextBound", index);
+      routing_.NextVar(index)->WhenBound(demon);
+    }
+  }
+
+  void InitialPropagate() override {
+    bound_indices_.clear();
+    for (int vehicle = 0; vehicle < routing_.vehicles(); ++vehicle)
+      CheckVehicle(vehicle);
+  }
+
+  std::string DebugString() const override { return "VectorCapacityConstraint"; }
+
+private:
+  void NextBound(int64 index) {
+    bound_indices_.push_back(index);
+    EnqueueDelayedDemon(check_demon_);
+  }
+
+  //  Checks once each vehicle whose route reaches its end from a bound next.
+  //  Each index is walked at most once, the vehicle its path reaches being
+  //  recorded for the walks meeting it later.
+  void CheckBoundRoutes() {
+    std::vector<int> vehicles;
+    for (const int64 bound_index : bound_indices_) {
+      const std::size_t path_begin = walked_.size();
+      int64 index                  = bound_index;
+      int vehicle                  = kUnreached;
+      while (true) {
+        if (routing_.IsEnd(index)) {
+          vehicle = routing_.VehicleIndex(index);
+          break;
+        }
+        if (reached_[index] != kUnwalked) {
+          vehicle = reached_[index];
+          break;
+        }
+        if (!routing_.NextVar(index)->Bound())
+          break;
+        reached_[index] = kUnreached;
+        walked_.push_back(index);
+        index = routing_.NextVar(index)->Value();
+      }
+      for (std::size_t position = path_begin; position < walked_.size(); ++position)
+        reached_[walked_[position]] = vehicle;
+      if (vehicle >= 0 && !checked_[vehicle]) {
+        checked_[vehicle] = true;
+        vehicles.push_back(vehicle);
+      }
+    }
+    for (const int64 index : walked_)
+      reached_[index] = kUnwalked;
+    walked_.clear();
+    bound_indices_.clear();
+    for (const int vehicle : vehicles)
+      checked_[vehicle] = false;
+    for (const int vehicle : vehicles)
+      CheckVehicle(vehicle);
+  }
+
+  void CheckVehicle(int vehicle) {
+    route_.clear();
+    int64 index = routing_.Start(vehicle);
+    while (!routing_.IsEnd(index) && routing_.NextVar(index)->Bound() &&
+           route_.size() <= static_cast<std::size_t>(routing_.Size())) {
+      route_.push_back(index);
+      index = routing_.NextVar(index)->Value();
+    }
+    if (!routing_.IsEnd(index))
+      return;
+    route_.push_back(index);
+    int64 overload_cost = 0;
+    if (!capacity_->Evaluate(vehicle, route_, &overload_cost))
+      solver()->Fail();
+    if (overloads_[vehicle] != nullptr)
+      overloads_[vehicle]->SetMin(overload_cost);
+  }
+
+  const RoutingModel& routing_;
+  const VectorCapacity* const capacity_;
+  const std::vector<IntVar*> overloads_;
+  Demon* check_demon_;
+  //  Nexts bound since the last check, not reversible: a failure only leaves
+  //  extra routes to check
+  std::vector<int64> bound_indices_;
+  std::vector<bool> checked_;
+  //  Vehicle reached from each index walked by the current check
+  std::vector<int> reached_;
+  std::vector<int64> walked_;
+  std::vector<int64> route_;
+};
+
+//  Lateness of a node over the union of its soft time windows, counted from
+//  the closest window opened before its start, carried by a cost variable. The
+//  cost is at least the late multiplier times the lateness from the earliest
+//  start of the time cumul. An active node starts within its windows extended
+//  by the lateness the maximal cost pays for.
+class UnionLatenessConstraint : public Constraint {
+public:
+  UnionLatenessConstraint(const TSPTWDataDT& data, const RoutingModel& routing,
+                          const RoutingIndexManager& manager, int64 index, IntVar* cumul,
+                          IntVar* cost)
+      : Constraint(routing.solver())
+      , data_(data)
+      , node_(manager.IndexToNode(index))
+      , active_(routing.ActiveVar(index))
+      , cumul_(cumul)
+      , cost_(cost)
+      , multiplier_(data.LateMultiplier(node_)) {
+    const std::vector<int64> ready = data.ReadyTime(node_);
+    const std::vector<int64> due   = data.DueTime(node_);
+    for (std::size_t tw = 0; tw < ready.size(); ++tw)
+      windows_.emplace_back(ready[tw], due[tw]);
+    std::sort(windows_.begin(), windows_.end());
+  }
+
+  void Post() override {
+    Demon* const demon = solver()->MakeConstraintInitialPropagateCallback(this);
+    active_->WhenBound(demon);
+    cumul_->WhenRange(demon);
+    cost_->WhenRange(demon);
+  }
+
+  void InitialPropagate() override {
+    const int64 lateness = data_.UnionLateness(node_, cumul_->Min(), cumul_->Max()).first;
+    cost_->SetMin(lateness > kint64max / multiplier_ ? kint64max
+                                                     : lateness * multiplier_);
+    if (active_->Min() == 0)
+      return;
+
+    // Starts later than the windows opened before them by more than the cost
+    // allows are removed
+    const int64 allowed = std::min(cost_->Max() / multiplier_, kint64max / 4);
+    int64 covered       = windows_.front().first - 1;
+    for (const std::pair<int64, int64>& window : windows_) {
+      if (window.first > covered + 1)
+        cumul_->RemoveInterval(covered + 1, window.first - 1);
+      covered = std::max(covered, window.second < CUSTOM_MAX_INT ? window.second + allowed
+                                                                 : kint64max);
+      if (covered == kint64max)
+        break;
+    }
+    cumul_->SetRange(windows_.front().first, covered);
+  }
+
+  std::string DebugString() const override { return "UnionLatenessConstraint"; }
+
+private:
+  const TSPTWDataDT& data_;
+  const RoutingIndexManager::NodeIndex node_;
+  IntVar* const active_;
+  IntVar* const cumul_;
+  IntVar* const cost_;
+  const int64 multiplier_;
+  //  Ready and due times by ready time
+  std::vector<std::pair<int64, int64>> windows_;
+};
+} // namespace
+
+Constraint* MakeLinkedNodesConstraint(const RoutingModel& routing,
+                                      const std::vector<int64>& indices,
+                                      LinkedActivity activity, LinkedVehicles vehicles,
+                                      bool direct_successors = false) {
+  return routing.solver()->RevAlloc(
+      new LinkedNodesConstraint(routing, indices, activity, vehicles, direct_successors));
+}
+
+Constraint* MakeDayLapseConstraint(const RoutingModel& routing, int64 previous,
+                                   int64 current, const std::vector<int>& vehicle_days,
+                                   const std::vector<int64>& day_first_vehicles,
+                                   int64 lapse, DayLapse type) {
+  return routing.solver()->RevAlloc(new DayLapseConstraint(
+      routing, previous, current, vehicle_days, day_first_vehicles, lapse, type));
+}
+
+VectorCapacity* MakeVectorCapacity(const TSPTWDataDT& data, const RoutingModel& routing,
+                                   const RoutingIndexManager& manager) {
+  return routing.solver()->RevAlloc(new VectorCapacity(data, manager));
+}
+
+Constraint* MakeVectorCapacityConstraint(const RoutingModel& routing,
+                                         const VectorCapacity* capacity,
+                                         const std::vector<IntVar*>& overloads) {
+  return routing.solver()->RevAlloc(
+      new VectorCapacityConstraint(routing, capacity, overloads));
+}
+
+Constraint* MakeUnionLatenessConstraint(const TSPTWDataDT& data,
+                                        const RoutingModel& routing,
+                                        const RoutingIndexManager& manager, int64 index,
+                                        IntVar* cumul, IntVar* cost) {
+  return routing.solver()->RevAlloc(
+      new UnionLatenessConstraint(data, routing, manager, index, cumul, cost));
+}
+} //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_CONSTRAINTS_H
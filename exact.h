@@ -0,0 +1,430 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_EXACT_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_EXACT_H
+
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <vector>
+
+#include "./limits.h"
+#include "./ortools_result.pb.h"
+#include "./scheduler.h"
+#include "./tsptw_data_dt.h"
+
+#include "ortools/constraint_solver/routing_index_manager.h"
+
+//  Labels are kept for each subset of services and last service, and vehicles
+//  share the subsets in O(3^n) per vehicle
+const int64 kExactMaximumSize = 12;
+//  Subset pairs the partition among the vehicles may enumerate, sixteen vehicles
+//  at the maximum size
+const int64 kExactMaximumWork = 16 * 531441;
+
+DEFINE_int64(exact_size, kExactMaximumSize,
+             "Number of services up to which problems are solved exactly by dynamic "
+             "programming, 0 to disable, at most 12");
+
+namespace operations_research {
+
+//  Exact solver for tiny problems. A dynamic programming over the subsets of
+//  services gives the best route of each vehicle for each subset, then another
+//  one over the partitions of the services among the vehicles gives the optimum.
+//  Partial routes keep Pareto labels of their cost, minimal duration, departure
+//  range and load range, so time windows and capacities prune them exactly.
+//  Only problems whose objective is a sum of route costs and exclusion costs are
+//  handled: no relation, rest, alternative, lateness, overload or shift
+//  preference.
+class ExactSolver {
+public:
+  ExactSolver(const TSPTWDataDT& data, const RoutingIndexManager& manager, int64 horizon,
+              std::vector<int64> penalties)
+      : data_(data)
+      , manager_(manager)
+      , horizon_(horizon)
+      , penalties_(std::move(penalties))
+      , size_(data.SizeMissions())
+      , unit_size_(data.Quantities(RoutingIndexManager::NodeIndex(0)).size())
+      , scheduler_(data, manager, true)
+      , maximum_route_distance_(0) {
+    std::map<int32, int> symmetry_classes;
+    for (const TSPTWDataDT::Vehicle* vehicle : data.Vehicles()) {
+      if (vehicle->distance == -1 || maximum_route_distance_ == INT_MAX)
+        maximum_route_distance_ = INT_MAX;
+      else
+        maximum_route_distance_ = std::max(maximum_route_distance_, vehicle->distance);
+
+      // Identical vehicles share their route costs, and no more of them than
+      // services can be used
+      int vehicle_class = class_sizes_.size();
+      if (vehicle->symmetry_class != -1) {
+        const int32 symmetry_class = vehicle->symmetry_class;
+        vehicle_class =
+            symmetry_classes.insert(std::make_pair(symmetry_class, vehicle_class))
+                .first->second;
+      }
+      if (vehicle_class == static_cast<int>(class_sizes_.size())) {
+        class_vehicles_.push_back(vehicle->vehicle_index);
+        class_sizes_.push_back(0);
+      }
+      if (class_sizes_[vehicle_class]++ < size_)
+        used_vehicles_.push_back(vehicle->vehicle_index);
+      vehicle_classes_.push_back(vehicle_class);
+    }
+  }
+
+  bool Applicable() const {
+    if (size_ == 0 || size_ > FLAGS_exact_size || size_ > kExactMaximumSize ||
+        !data_.Relations().empty() || FLAGS_balance || FLAGS_nearby ||
+        FLAGS_vehicle_limit > 0)
+      return false;
+    int64 work = used_vehicles_.size();
+    for (int i = 0; i < size_ && work <= kExactMaximumWork; ++i)
+      work *= 3;
+    if (work > kExactMaximumWork)
+      return false;
+    for (int32 activity = 0; activity <= data_.SizeProblem(); ++activity) {
+      if (data_.AlternativeSize(activity) > 1)
+        return false;
+    }
+    for (int i = 0; i < size_; ++i) {
+      const RoutingIndexManager::NodeIndex node(i);
+      if (data_.ReadyTime(node).size() > 1 || data_.LateMultiplier(node) > 0)
+        return false;
+      for (const bool refill : data_.RefillQuantities(node)) {
+        if (refill)
+          return false;
+      }
+    }
+    for (const TSPTWDataDT::Vehicle* vehicle : data_.Vehicles()) {
+      if (vehicle->break_size > 0 || !vehicle->rests.empty() ||
+          vehicle->late_multiplier > 0 || vehicle->free_approach ||
+          vehicle->free_return || vehicle->shift_preference != MinimizeSpan)
+        return false;
+      for (std::size_t unit = 0; unit < vehicle->capacity.size(); ++unit) {
+        if (vehicle->capacity[unit] >= 0 && vehicle->overload_multiplier[unit] > 0)
+          return false;
+      }
+    }
+    return true;
+  }
+
+  //  Fills the routes, the cost and its details. False when no service can be
+  //  left unperformed and no solution serves them all.
+  bool Solve(ortools_result::Result* result) {
+    const int size_vehicles = data_.Vehicles().size();
+    const int size_used     = used_vehicles_.size();
+    const uint32 full_set   = (1u << size_) - 1;
+    const int size_classes  = class_vehicles_.size();
+    sequences_.assign(size_classes, std::vector<std::vector<int>>(full_set + 1));
+    std::vector<std::vector<int64>> route_costs(size_classes);
+    for (int vehicle_class = 0; vehicle_class < size_classes; ++vehicle_class)
+      route_costs[vehicle_class] = RouteCosts(vehicle_class);
+
+    // Best cost of serving a subset with the first used vehicles
+    std::vector<int64> costs(full_set + 1, kint64max);
+    costs[0] = 0;
+    std::vector<std::vector<uint32>> vehicle_sets(size_used,
+                                                  std::vector<uint32>(full_set + 1, 0));
+    for (int used = 0; used < size_used; ++used) {
+      const std::vector<int64>& class_costs =
+          route_costs[vehicle_classes_[used_vehicles_[used]]];
+      std::vector<int64> vehicle_costs(costs);
+      for (uint32 set = 1; set <= full_set; ++set) {
+        for (uint32 subset = set; subset > 0; subset = (subset - 1) & set) {
+          const int64 cost = Add(class_costs[subset], costs[set & ~subset]);
+          if (cost < vehicle_costs[set]) {
+            vehicle_costs[set]      = cost;
+            vehicle_sets[used][set] = subset;
+          }
+        }
+      }
+      costs.swap(vehicle_costs);
+    }
+
+    int64 best_cost = kint64max;
+    uint32 best_set = 0;
+    for (uint32 set = 0; set <= full_set; ++set) {
+      int64 cost = costs[set];
+      for (int i = 0; i < size_; ++i) {
+        if (!(set & (1u << i)))
+          cost = Add(cost, penalties_[i]);
+      }
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_set  = set;
+      }
+    }
+    if (best_cost == kint64max)
+      return false;
+
+    std::vector<std::vector<int>> routes(size_vehicles);
+    for (int used = size_used - 1; used >= 0; --used) {
+      const int vehicle   = used_vehicles_[used];
+      const uint32 subset = vehicle_sets[used][best_set];
+      routes[vehicle]     = sequences_[vehicle_classes_[vehicle]][subset];
+      best_set &= ~subset;
+    }
+    FillResult(routes, best_cost, result);
+    return true;
+  }
+
+private:
+  //  Partial route ending at a service. Departing from the start within
+  //  [earliest, latest] reaches the service after the minimal duration, loads
+  //  range from the current one plus low to the current one plus high.
+  struct Label {
+    int64 cost;
+    int64 duration;
+    int64 earliest;
+    int64 latest;
+    int64 distance;
+    std::vector<int64> lows;
+    std::vector<int64> highs;
+    int previous;
+    int parent;
+  };
+
+  static int64 Add(int64 a, int64 b) {
+    if (a == kint64max || b == kint64max)
+      return kint64max;
+    return a + b;
+  }
+
+  int64 Ready(RoutingIndexManager::NodeIndex node) const {
+    const std::vector<int64> ready = data_.ReadyTime(node);
+    return ready.empty() ? 0 : std::max<int64>(ready[0], 0);
+  }
+
+  int64 Due(RoutingIndexManager::NodeIndex node) const {
+    const std::vector<int64> due = data_.DueTime(node);
+    return due.empty() || due[0] >= CUSTOM_MAX_INT ? horizon_
+                                                   : std::min(due[0], horizon_);
+  }
+
+  int64 DistanceLimit(const TSPTWDataDT::Vehicle* vehicle) const {
+    return vehicle->distance > 0 ? std::min(vehicle->distance, maximum_route_distance_)
+                                 : maximum_route_distance_;
+  }
+
+  //  Route costs without the waiting part, which depends on the whole route
+  int64 ArcCost(const TSPTWDataDT::Vehicle* vehicle, RoutingIndexManager::NodeIndex from,
+                RoutingIndexManager::NodeIndex to) const {
+    return vehicle->cost_distance_multiplier * vehicle->Distance(from, to) +
+           vehicle->cost_value_multiplier * vehicle->ValuePlusServiceValue(from, to) +
+           std::max<int64>(vehicle->cost_time_multiplier -
+                               vehicle->cost_waiting_time_multiplier,
+                           0) *
+               vehicle->TimePlusServiceTime(from, to);
+  }
+
+  //  Extends the label to the node with a window of [ready, due], false when
+  //  the node can't be reached in time or overloads the vehicle
+  bool Extend(const TSPTWDataDT::Vehicle* vehicle, RoutingIndexManager::NodeIndex from,
+              RoutingIndexManager::NodeIndex to, int64 ready, int64 due,
+              Label* label) const {
+    const int64 time    = vehicle->TimePlusServiceTime(from, to);
+    const int64 delta   = label->duration + time;
+    const int64 waiting = std::max<int64>(ready - delta - label->latest, 0);
+    if (label->earliest + delta > due)
+      return false;
+    label->earliest = std::max(ready - delta, label->earliest) - waiting;
+    label->latest   = std::min(due - delta, label->latest);
+    label->duration = delta + waiting;
+    label->distance += vehicle->Distance(from, to);
+    label->cost += ArcCost(vehicle, from, to);
+    if (label->distance > DistanceLimit(vehicle) ||
+        (vehicle->duration >= 0 &&
+         vehicle->time_end - vehicle->time_start > vehicle->duration &&
+         label->duration > vehicle->duration))
+      return false;
+    for (std::size_t unit = 0; unit < label->lows.size(); ++unit) {
+      const int64 quantity = data_.Quantity(unit, from, to);
+      label->lows[unit]    = std::min<int64>(label->lows[unit] - quantity, 0);
+      label->highs[unit]   = std::max<int64>(label->highs[unit] - quantity, 0);
+      const int64 capacity =
+          unit < vehicle->capacity.size() ? vehicle->capacity[unit] : -1;
+      if (capacity >= 0 && label->highs[unit] - label->lows[unit] > capacity)
+        return false;
+    }
+    return true;
+  }
+
+  static bool Dominates(const Label& a, const Label& b) {
+    if (a.cost > b.cost || a.duration > b.duration || a.latest < b.latest ||
+        a.earliest + a.duration > b.earliest + b.duration || a.distance > b.distance)
+      return false;
+    for (std::size_t unit = 0; unit < a.lows.size(); ++unit) {
+      if (a.lows[unit] < b.lows[unit] || a.highs[unit] > b.highs[unit])
+        return false;
+    }
+    return true;
+  }
+
+  static void Insert(const Label& label, std::vector<Label>* labels) {
+    for (const Label& other : *labels) {
+      if (Dominates(other, label))
+        return;
+    }
+    labels->erase(std::remove_if(labels->begin(), labels->end(),
+                                 [&label](const Label& other) {
+                                   return Dominates(label, other);
+                                 }),
+                  labels->end());
+    labels->push_back(label);
+  }
+
+  //  Cost of the best route of the vehicles of the class serving exactly each
+  //  subset of services, kint64max when the subset can't be served. The
+  //  sequences of the best routes are kept.
+  std::vector<int64> RouteCosts(int vehicle_class) {
+    const int vehicle                        = class_vehicles_[vehicle_class];
+    const TSPTWDataDT::Vehicle* data_vehicle = data_.Vehicles().at(vehicle);
+    const uint32 full_set                    = (1u << size_) - 1;
+    std::vector<int64> route_costs(full_set + 1, kint64max);
+    route_costs[0] = 0;
+
+    std::vector<bool> allowed(size_, true);
+    for (int i = 0; i < size_; ++i) {
+      const std::vector<int64> vehicle_indices =
+          data_.VehicleIndices(RoutingIndexManager::NodeIndex(i));
+      allowed[i] = vehicle_indices.empty() ||
+                   std::find(vehicle_indices.begin(), vehicle_indices.end(), vehicle) !=
+                       vehicle_indices.end();
+    }
+
+    Label start;
+    start.cost     = 0;
+    start.duration = 0;
+    start.earliest = std::max<int64>(data_vehicle->time_start, 0);
+    start.latest   = horizon_;
+    start.distance = 0;
+    start.lows.assign(unit_size_, 0);
+    start.highs.assign(unit_size_, 0);
+    start.previous = -1;
+    start.parent   = -1;
+
+    std::vector<std::vector<std::vector<Label>>> labels(
+        full_set + 1, std::vector<std::vector<Label>>(size_));
+    for (int i = 0; i < size_; ++i) {
+      const RoutingIndexManager::NodeIndex node(i);
+      Label label = start;
+      if (allowed[i] &&
+          Extend(data_vehicle, data_vehicle->start, node, Ready(node), Due(node), &label))
+        labels[1u << i][i].push_back(label);
+    }
+
+    const int64 end_due = data_vehicle->time_end < CUSTOM_MAX_INT
+                              ? std::min(data_vehicle->time_end, horizon_)
+                              : horizon_;
+    for (uint32 set = 1; set <= full_set; ++set) {
+      int best_last   = -1;
+      int best_parent = -1;
+      for (int last = 0; last < size_; ++last) {
+        const std::vector<Label>& last_labels = labels[set][last];
+        const RoutingIndexManager::NodeIndex from(last);
+        for (std::size_t parent = 0; parent < last_labels.size(); ++parent) {
+          // Extensions to the services left
+          for (int next = 0; next < size_; ++next) {
+            if ((set & (1u << next)) || !allowed[next])
+              continue;
+            const RoutingIndexManager::NodeIndex to(next);
+            Label label    = last_labels[parent];
+            label.previous = last;
+            label.parent   = parent;
+            if (Extend(data_vehicle, from, to, Ready(to), Due(to), &label))
+              Insert(label, &labels[set | (1u << next)][next]);
+          }
+
+          // Return to the end of the vehicle
+          Label label = last_labels[parent];
+          if (!Extend(data_vehicle, from, data_vehicle->stop, 0, end_due, &label))
+            continue;
+          const int64 cost = data_vehicle->cost_fixed + label.cost +
+                             data_vehicle->cost_waiting_time_multiplier * label.duration;
+          if (cost < route_costs[set]) {
+            route_costs[set] = cost;
+            best_last        = last;
+            best_parent      = parent;
+          }
+        }
+      }
+
+      std::vector<int>& sequence = sequences_[vehicle_class][set];
+      for (uint32 route_set = set; best_last >= 0;) {
+        sequence.push_back(best_last);
+        const Label& label = labels[route_set][best_last][best_parent];
+        route_set &= ~(1u << best_last);
+        best_last   = label.previous;
+        best_parent = label.parent;
+      }
+      std::reverse(sequence.begin(), sequence.end());
+    }
+    return route_costs;
+  }
+
+  void FillResult(const std::vector<std::vector<int>>& routes, int64 cost,
+                  ortools_result::Result* result) const {
+    ortools_result::CostDetails* details = result->mutable_cost_details();
+    if (result->routes_size() > 0)
+      result->clear_routes();
+    double fixed(0), time(0), distance(0), time_without_wait(0), value(0);
+    for (int vehicle = 0; vehicle < static_cast<int>(routes.size()); ++vehicle) {
+      const TSPTWDataDT::Vehicle* data_vehicle = data_.Vehicles().at(vehicle);
+      std::vector<int64> route(1, manager_.GetStartIndex(vehicle));
+      for (const int i : routes[vehicle])
+        route.push_back(manager_.NodeToIndex(RoutingIndexManager::NodeIndex(i)));
+      route.push_back(manager_.GetEndIndex(vehicle));
+      const std::vector<int64> start_times = scheduler_.Schedule(vehicle, route);
+      const std::vector<std::vector<int64>> quantities = scheduler_.Quantities(route);
+
+      const int64 route_distance = AddRouteActivities(
+          data_, manager_, vehicle, route, start_times, quantities, {},
+          result->add_routes());
+      int64 route_value = 0;
+      int64 route_time  = 0;
+      for (std::size_t position = 0; position + 1 < route.size(); ++position) {
+        const RoutingIndexManager::NodeIndex node = manager_.IndexToNode(route[position]);
+        const RoutingIndexManager::NodeIndex next =
+            manager_.IndexToNode(route[position + 1]);
+        route_value += data_vehicle->ValuePlusServiceValue(node, next);
+        route_time += data_vehicle->TimePlusServiceTime(node, next);
+      }
+      if (routes[vehicle].empty())
+        continue;
+      fixed += data_vehicle->cost_fixed / CUSTOM_BIGNUM;
+      time += data_vehicle->cost_waiting_time_multiplier *
+              (start_times.back() - start_times.front()) / CUSTOM_BIGNUM;
+      distance += data_vehicle->cost_distance_multiplier * route_distance / CUSTOM_BIGNUM;
+      time_without_wait += std::max<int64>(data_vehicle->cost_time_multiplier -
+                                               data_vehicle->cost_waiting_time_multiplier,
+                                           0) *
+                           route_time / CUSTOM_BIGNUM;
+      value += data_vehicle->cost_value_multiplier * route_value / CUSTOM_BIGNUM;
+    }
+    details->set_fixed(fixed);
+    details->set_time(time);
+    details->set_distance(distance);
+    details->set_time_without_wait(time_without_wait);
+    details->set_value(value);
+    result->set_cost(cost / CUSTOM_BIGNUM);
+  }
+
+  const TSPTWDataDT& data_;
+  const RoutingIndexManager& manager_;
+  const int64 horizon_;
+  const std::vector<int64> penalties_;
+  const int size_;
+  const std::size_t unit_size_;
+  const RouteScheduler scheduler_;
+  int64 maximum_route_distance_;
+  //  First vehicle and number of vehicles of each class, class of each vehicle
+  std::vector<int> class_vehicles_;
+  std::vector<int> class_sizes_;
+  std::vector<int> vehicle_classes_;
+  //  Vehicles the partition goes through
+  std::vector<int> used_vehicles_;
+  std::vector<std::vector<std::vector<int>>> sequences_;
+};
+} //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_EXACT_H
@@ -0,0 +1,709 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_FILTERS_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_FILTERS_H
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <vector>
+
+#include "./constraints.h"
+#include "./tsptw_data_dt.h"
+
+#include "ortools/constraint_solver/constraint_solver.h"
+#include "ortools/constraint_solver/routing.h"
+
+DEFINE_bool(break_vehicle_symmetry, false,
+            "Use identical vehicles in order and reject moves only permuting their routes");
+DEFINE_bool(relation_filters, true,
+            "Reject local search moves breaking relations before propagation");
+DEFINE_bool(time_window_filter, true,
+            "Reject local search moves breaking hard time windows before propagation");
+
+namespace operations_research {
+namespace {
+
+//  Base of the filters checking the routes a move changes. Synchronization
+//  keeps the vehicle and position of each node and the route of each vehicle,
+//  from its start to its end when reached. Accept gathers the new nexts of the
+//  move in node-indexed vectors, along with the touched vehicles and their
+//  first and last changed positions, reset from the changed nodes once the move
+//  is checked. Moves deactivating nexts are left to propagation.
+class RoutePathFilter : public IntVarLocalSearchFilter {
+public:
+  explicit RoutePathFilter(const RoutingModel& routing)
+      : IntVarLocalSearchFilter(routing.Nexts())
+      , routing_(routing)
+      , node_vehicles_(routing.Size(), -1)
+      , node_positions_(routing.Size(), -1)
+      , routes_(routing.vehicles())
+      , first_changed_(routing.vehicles(), -1)
+      , last_changed_(routing.vehicles(), -1)
+      , new_nexts_(routing.Size(), -1) {}
+
+  bool Accept(const Assignment* delta, const Assignment*) override {
+    const Assignment::IntContainer& container = delta->IntVarContainer();
+    bool complete                             = true;
+    for (int i = 0; i < container.Size(); ++i) {
+      const IntVarElement& element = container.Element(i);
+      int64 index                  = -1;
+      if (!FindIndex(element.Var(), &index))
+        continue;
+      if (!element.Activated()) {
+        complete = false;
+        break;
+      }
+      new_nexts_[index] = element.Value();
+      changed_.push_back(index);
+      const int vehicle = node_vehicles_[index];
+      if (vehicle < 0)
+        continue;
+      if (first_changed_[vehicle] < 0) {
+        touched_.push_back(vehicle);
+        first_changed_[vehicle] = node_positions_[index];
+        last_changed_[vehicle]  = node_positions_[index];
+      }
+      first_changed_[vehicle] = std::min(first_changed_[vehicle], node_positions_[index]);
+      last_changed_[vehicle]  = std::max(last_changed_[vehicle], node_positions_[index]);
+    }
+    const bool accepted = !complete || AcceptMove();
+
+    for (const int64 index : changed_)
+      new_nexts_[index] = -1;
+    for (const int vehicle : touched_) {
+      first_changed_[vehicle] = -1;
+      last_changed_[vehicle]  = -1;
+    }
+    changed_.clear();
+    touched_.clear();
+    return accepted;
+  }
+
+protected:
+  //  Checks the gathered move
+  virtual bool AcceptMove() = 0;
+
+  //  Called once the routes are synchronized
+  virtual void OnRoutesSynchronized() {}
+
+  bool Changed(int64 index) const { return new_nexts_[index] >= 0; }
+
+  int64 NewNext(int64 index) const {
+    return Changed(index) ? new_nexts_[index] : Value(index);
+  }
+
+  //  Nodes of the new route of vehicle from its start to its end. False on an
+  //  inconsistent path.
+  bool NewRoute(int vehicle, std::vector<int64>* route) const {
+    route->clear();
+    int64 index = routing_.Start(vehicle);
+    while (!routing_.IsEnd(index)) {
+      if (route->size() > node_vehicles_.size() ||
+          (!Changed(index) && !IsVarSynced(index)))
+        return false;
+      route->push_back(index);
+      index = NewNext(index);
+    }
+    route->push_back(index);
+    return index == routing_.End(vehicle);
+  }
+
+  const RoutingModel& routing_;
+  std::vector<int> node_vehicles_;
+  std::vector<int> node_positions_;
+  std::vector<std::vector<int64>> routes_;
+  std::vector<int> first_changed_;
+  std::vector<int> last_changed_;
+  std::vector<int64> changed_;
+  std::vector<int> touched_;
+
+private:
+  void OnSynchronize(const Assignment*) override {
+    std::fill(node_vehicles_.begin(), node_vehicles_.end(), -1);
+    std::fill(node_positions_.begin(), node_positions_.end(), -1);
+    for (int vehicle = 0; vehicle < routing_.vehicles(); ++vehicle) {
+      std::vector<int64>& route = routes_[vehicle];
+      route.clear();
+      int64 index = routing_.Start(vehicle);
+      while (!routing_.IsEnd(index) && route.size() < node_vehicles_.size()) {
+        node_vehicles_[index]  = vehicle;
+        node_positions_[index] = route.size();
+        route.push_back(index);
+        if (!IsVarSynced(index))
+          break;
+        index = Value(index);
+      }
+      if (routing_.IsEnd(index))
+        route.push_back(index);
+    }
+    OnRoutesSynchronized();
+  }
+
+  std::vector<int64> new_nexts_;
+};
+
+//  Rejects the moves whose only effect is to exchange the routes of identical
+//  vehicles. Other moves are left to the following filters.
+class VehicleSymmetryFilter : public RoutePathFilter {
+public:
+  VehicleSymmetryFilter(const TSPTWDataDT& data, const RoutingModel& routing)
+      : RoutePathFilter(routing)
+      , filtered_moves_(0) {
+    for (const TSPTWDataDT::Vehicle* vehicle : data.Vehicles())
+      vehicle_classes_.push_back(vehicle->symmetry_class);
+  }
+
+  int64 FilteredMoves() const { return filtered_moves_; }
+
+private:
+  bool AcceptMove() override {
+    // A move touching unperformed nodes or unique vehicles changes more than
+    // the vehicle assignment
+    for (const int64 index : changed_) {
+      if (node_vehicles_[index] == -1 || vehicle_classes_[node_vehicles_[index]] == -1)
+        return true;
+    }
+    if (touched_.size() < 2)
+      return true;
+
+    std::map<int, std::vector<std::vector<int64>>> old_routes;
+    std::map<int, std::vector<std::vector<int64>>> new_routes;
+    for (const int vehicle : touched_) {
+      const std::vector<int64>& old_route = routes_[vehicle];
+      if (!routing_.IsEnd(old_route.back()) || !NewRoute(vehicle, &route_))
+        return true;
+      // Without the depots, which differ from one vehicle to the other
+      old_routes[vehicle_classes_[vehicle]].emplace_back(old_route.begin() + 1,
+                                                         old_route.end() - 1);
+      new_routes[vehicle_classes_[vehicle]].emplace_back(route_.begin() + 1,
+                                                         route_.end() - 1);
+    }
+    for (auto& vehicle_class : old_routes) {
+      std::vector<std::vector<int64>>& routes = new_routes[vehicle_class.first];
+      std::sort(vehicle_class.second.begin(), vehicle_class.second.end());
+      std::sort(routes.begin(), routes.end());
+      if (vehicle_class.second != routes)
+        return true;
+    }
+    ++filtered_moves_;
+    return false;
+  }
+
+  std::vector<int32> vehicle_classes_;
+  std::vector<int64> route_;
+  int64 filtered_moves_;
+};
+
+//  Rejects the moves breaking Sequence, Order, SameRoute, MaximumDurationLapse
+//  and VehicleTrips relations, from the paths of the move only. Time relations
+//  are checked against travel and service time lower bounds.
+//
+//  A move only walks the changed part of each route it touches, from its first
+//  changed node to the first node of an unchanged suffix. Nodes out of these
+//  paths keep their vehicle and position, or the shift of the suffix they
+//  belong to.
+class RelationFilter : public RoutePathFilter {
+public:
+  RelationFilter(const TSPTWDataDT& data, const RoutingModel& routing,
+                 const RoutingIndexManager& manager)
+      : RoutePathFilter(routing)
+      , data_(data)
+      , manager_(manager)
+      , node_relations_(routing.Size())
+      , vehicle_relations_(routing.vehicles())
+      , min_ready_times_(routing.Size(), -CUSTOM_MAX_INT)
+      , route_groups_(routing.vehicles())
+      , new_vehicles_(routing.Size(), -1)
+      , new_positions_(routing.Size(), -1)
+      , suffix_vehicles_(routing.vehicles(), -1)
+      , suffix_starts_(routing.vehicles(), -1)
+      , suffix_shifts_(routing.vehicles(), 0)
+      , filtered_moves_()
+      , accepted_moves_() {
+    for (const TSPTWDataDT::Relation* relation : data.Relations()) {
+      LinkedGroup group;
+      group.type  = relation->type;
+      group.lapse = relation->lapse;
+      if (relation->type == VehicleTrips) {
+        for (const std::string& vehicle_id : *relation->linked_vehicle_ids)
+          group.indices.push_back(data.VehicleIdIndex(vehicle_id));
+        for (const int64 vehicle : group.indices)
+          vehicle_relations_[vehicle].push_back(groups_.size());
+      } else if (relation->type == Sequence || relation->type == Order ||
+                 relation->type == SameRoute ||
+                 (relation->type == MaximumDurationLapse && relation->lapse >= 0)) {
+        for (const std::string& linked_id : *relation->linked_ids)
+          group.indices.push_back(data.IdIndex(linked_id));
+        for (const int64 index : group.indices)
+          node_relations_[index].push_back(groups_.size());
+      } else {
+        continue;
+      }
+      groups_.push_back(group);
+    }
+    marked_groups_.assign(groups_.size(), false);
+    for (int i = 0; i < data.SizeMissions(); ++i) {
+      const std::vector<int64> ready_times =
+          data.ReadyTime(RoutingIndexManager::NodeIndex(i));
+      if (!ready_times.empty())
+        min_ready_times_[manager.NodeToIndex(RoutingIndexManager::NodeIndex(i))] =
+            *std::min_element(ready_times.begin(), ready_times.end());
+    }
+  }
+
+  int64 FilteredMoves(RelationType type) const { return filtered_moves_[type]; }
+
+  int64 AcceptedMoves(RelationType type) const { return accepted_moves_[type]; }
+
+private:
+  struct LinkedGroup {
+    RelationType type;
+    int64 lapse;
+    std::vector<int64> indices;
+  };
+
+  bool AcceptMove() override {
+    if (groups_.empty())
+      return true;
+    const bool accepted = CheckTouchedRoutes();
+    for (const int64 index : walked_) {
+      new_vehicles_[index]  = -1;
+      new_positions_[index] = -1;
+    }
+    for (const int vehicle : touched_) {
+      suffix_vehicles_[vehicle] = -1;
+      suffix_starts_[vehicle]   = -1;
+      suffix_shifts_[vehicle]   = 0;
+    }
+    walked_.clear();
+    return accepted;
+  }
+
+  //  Groups of the nodes of each route
+  void OnRoutesSynchronized() override {
+    for (int vehicle = 0; vehicle < routing_.vehicles(); ++vehicle) {
+      std::vector<int>& groups = route_groups_[vehicle];
+      groups.clear();
+      for (const int64 index : routes_[vehicle]) {
+        if (!routing_.IsEnd(index))
+          MarkGroups(node_relations_[index], &groups);
+      }
+      for (const int group : groups)
+        marked_groups_[group] = false;
+    }
+  }
+
+  bool NewActive(int64 index) const { return NewNext(index) != index; }
+
+  int NewVehicle(int64 index) const {
+    if (new_vehicles_[index] >= 0)
+      return new_vehicles_[index];
+    const int vehicle = node_vehicles_[index];
+    if (vehicle < 0 || first_changed_[vehicle] < 0 ||
+        node_positions_[index] <= first_changed_[vehicle])
+      return vehicle;
+    if (suffix_starts_[vehicle] >= 0 && node_positions_[index] >= suffix_starts_[vehicle])
+      return suffix_vehicles_[vehicle];
+    // Left its route
+    return -1;
+  }
+
+  int NewPosition(int64 index) const {
+    if (new_positions_[index] >= 0)
+      return new_positions_[index];
+    const int vehicle = node_vehicles_[index];
+    if (vehicle >= 0 && first_changed_[vehicle] >= 0 && suffix_starts_[vehicle] >= 0 &&
+        node_positions_[index] >= suffix_starts_[vehicle])
+      return node_positions_[index] + suffix_shifts_[vehicle];
+    return node_positions_[index];
+  }
+
+  //  Walks the changed path of each touched route, up to the end or to the
+  //  unchanged suffix of a route. False when the paths are not consistent.
+  bool WalkChangedPaths() {
+    for (const int vehicle : touched_) {
+      // From the first changed node, whose predecessors are unchanged
+      int position = first_changed_[vehicle];
+      int64 index  = routes_[vehicle][position];
+      for (std::size_t steps = 0;; ++steps) {
+        if (steps > node_vehicles_.size() || (!Changed(index) && !IsVarSynced(index)))
+          return false;
+        const int64 next = NewNext(index);
+        if (routing_.IsEnd(next))
+          break;
+        ++position;
+        const int next_vehicle = node_vehicles_[next];
+        // A node before the first change of its route keeps its predecessor
+        if (next_vehicle >= 0 && (first_changed_[next_vehicle] < 0 ||
+                                  node_positions_[next] <= first_changed_[next_vehicle]))
+          return false;
+        if (next_vehicle >= 0 && node_positions_[next] > last_changed_[next_vehicle]) {
+          suffix_vehicles_[next_vehicle] = vehicle;
+          suffix_starts_[next_vehicle]   = node_positions_[next];
+          suffix_shifts_[next_vehicle]   = position - node_positions_[next];
+          break;
+        }
+        if (new_vehicles_[next] >= 0)
+          return false;
+        new_vehicles_[next]  = vehicle;
+        new_positions_[next] = position;
+        walked_.push_back(next);
+        index = next;
+      }
+    }
+    return true;
+  }
+
+  void MarkGroups(const std::vector<int>& groups, std::vector<int>* marked) {
+    for (const int group : groups) {
+      if (!marked_groups_[group]) {
+        marked_groups_[group] = true;
+        marked->push_back(group);
+      }
+    }
+  }
+
+  bool CheckTouchedRoutes() {
+    // Inconsistent paths are left to propagation
+    if (!WalkChangedPaths())
+      return true;
+
+    // Groups of the nodes whose next, vehicle or position may have changed
+    std::vector<int> groups;
+    for (const int64 index : changed_)
+      MarkGroups(node_relations_[index], &groups);
+    for (const int64 index : walked_)
+      MarkGroups(node_relations_[index], &groups);
+    for (const int vehicle : touched_) {
+      MarkGroups(route_groups_[vehicle], &groups);
+      MarkGroups(vehicle_relations_[vehicle], &groups);
+    }
+    for (const int group : groups)
+      marked_groups_[group] = false;
+
+    std::array<bool, NeverLast + 1> checked_types = {};
+    for (const int group : groups) {
+      const RelationType type = groups_[group].type;
+      if (!CheckGroup(groups_[group])) {
+        ++filtered_moves_[type];
+        return false;
+      }
+      checked_types[type] = true;
+    }
+    for (std::size_t type = 0; type < checked_types.size(); ++type) {
+      if (checked_types[type])
+        ++accepted_moves_[type];
+    }
+    return true;
+  }
+
+  bool CheckGroup(const LinkedGroup& group) const {
+    if (group.type == VehicleTrips) {
+      for (std::size_t k = 1; k < group.indices.size(); ++k) {
+        if (EarliestEnd(group.indices[k - 1]) > LatestStart(group.indices[k]))
+          return false;
+      }
+      return true;
+    }
+    for (std::size_t k = 1; k < group.indices.size(); ++k) {
+      const int64 previous = group.indices[k - 1];
+      const int64 current  = group.indices[k];
+      if (!NewActive(current))
+        continue;
+      if (!NewActive(previous))
+        return false;
+      switch (group.type) {
+      case Sequence:
+        if (NewNext(previous) != current)
+          return false;
+        break;
+      case SameRoute:
+        if (NewVehicle(previous) != NewVehicle(current))
+          return false;
+        break;
+      case Order:
+        if (NewVehicle(previous) != NewVehicle(current) ||
+            NewPosition(previous) > NewPosition(current))
+          return false;
+        break;
+      case MaximumDurationLapse:
+        if (NewVehicle(previous) >= 0 && NewVehicle(previous) == NewVehicle(current) &&
+            NewPosition(previous) < NewPosition(current) &&
+            RouteTime(NewVehicle(previous), previous, current) > group.lapse)
+          return false;
+        break;
+      default:
+        break;
+      }
+    }
+    return true;
+  }
+
+  int64 Transit(int vehicle, int64 from, int64 to) const {
+    return data_.Vehicles().at(vehicle)->TimePlusServiceTime(manager_.IndexToNode(from),
+                                                            manager_.IndexToNode(to));
+  }
+
+  //  Travel and service time between two nodes of the new route
+  int64 RouteTime(int vehicle, int64 from, int64 to) const {
+    int64 time        = 0;
+    int64 index       = from;
+    std::size_t steps = 0;
+    while (index != to && !routing_.IsEnd(index) && steps++ <= node_vehicles_.size()) {
+      const int64 next = NewNext(index);
+      time += Transit(vehicle, index, next);
+      index = next;
+    }
+    return time;
+  }
+
+  int64 EarliestEnd(int vehicle) const {
+    int64 time        = data_.Vehicles().at(vehicle)->time_start;
+    int64 previous    = routing_.Start(vehicle);
+    int64 index       = NewNext(previous);
+    std::size_t steps = 0;
+    while (!routing_.IsEnd(index) && steps++ <= node_vehicles_.size()) {
+      time     = std::max(time + Transit(vehicle, previous, index), min_ready_times_[index]);
+      previous = index;
+      index    = NewNext(index);
+    }
+    return time + Transit(vehicle, previous, routing_.End(vehicle));
+  }
+
+  int64 LatestStart(int vehicle) const {
+    const TSPTWDataDT::Vehicle* data_vehicle = data_.Vehicles().at(vehicle);
+    if (data_vehicle->late_multiplier > 0 || data_vehicle->time_end >= CUSTOM_MAX_INT)
+      return CUSTOM_MAX_INT;
+    int64 time        = data_vehicle->time_end;
+    int64 previous    = routing_.Start(vehicle);
+    int64 index       = NewNext(previous);
+    std::size_t steps = 0;
+    while (!routing_.IsEnd(index) && steps++ <= node_vehicles_.size()) {
+      time -= Transit(vehicle, previous, index);
+      previous = index;
+      index    = NewNext(index);
+    }
+    return time - Transit(vehicle, previous, routing_.End(vehicle));
+  }
+
+  const TSPTWDataDT& data_;
+  const RoutingIndexManager& manager_;
+  std::vector<LinkedGroup> groups_;
+  std::vector<std::vector<int>> node_relations_;
+  std::vector<std::vector<int>> vehicle_relations_;
+  std::vector<int64> min_ready_times_;
+  std::vector<std::vector<int>> route_groups_;
+  std::vector<bool> marked_groups_;
+  //  Paths walked by the move, reset from the walked nodes and the touched
+  //  vehicles
+  std::vector<int> new_vehicles_;
+  std::vector<int> new_positions_;
+  std::vector<int> suffix_vehicles_;
+  std::vector<int> suffix_starts_;
+  std::vector<int> suffix_shifts_;
+  std::vector<int64> walked_;
+  std::array<int64, NeverLast + 1> filtered_moves_;
+  std::array<int64, NeverLast + 1> accepted_moves_;
+};
+
+//  Rejects the moves exceeding a hard capacity on one of the routes they
+//  change, checking all capacity units of a route at once.
+class VectorCapacityFilter : public RoutePathFilter {
+public:
+  VectorCapacityFilter(const RoutingModel& routing, const VectorCapacity* capacity)
+      : RoutePathFilter(routing)
+      , capacity_(capacity) {}
+
+private:
+  bool AcceptMove() override {
+    for (const int vehicle : touched_) {
+      if (!NewRoute(vehicle, &route_))
+        return true;
+      int64 overload_cost = 0;
+      if (!capacity_->Evaluate(vehicle, route_, &overload_cost))
+        return false;
+    }
+    return true;
+  }
+
+  const VectorCapacity* const capacity_;
+  std::vector<int64> route_;
+};
+
+//  Rejects the moves breaking hard time windows, holes between windows
+//  included. Synchronized routes keep the earliest and latest start of each
+//  position; a move only walks its changed nodes, from the unchanged prefix to
+//  the first unchanged suffix, whose latest start bounds the arrival. Breaks,
+//  durations and soft bounds are left to propagation, so the filter only
+//  rejects infeasible moves.
+class TimeWindowFilter : public RoutePathFilter {
+public:
+  TimeWindowFilter(const TSPTWDataDT& data, const RoutingModel& routing,
+                   const RoutingIndexManager& manager)
+      : RoutePathFilter(routing)
+      , data_(data)
+      , manager_(manager)
+      , window_starts_(data.SizeMissions() + 1, 0)
+      , earliest_starts_(routing.vehicles())
+      , latest_starts_(routing.vehicles()) {
+    for (int i = 0; i < data.SizeMissions(); ++i) {
+      const RoutingIndexManager::NodeIndex node(i);
+      const std::vector<int64> ready = data.ReadyTime(node);
+      const std::vector<int64> due   = data.DueTime(node);
+      if (ready.empty()) {
+        readies_.push_back(kint64min);
+        dues_.push_back(kint64max);
+      } else if (data.LateMultiplier(node) > 0) {
+        readies_.push_back(*std::min_element(ready.begin(), ready.end()));
+        dues_.push_back(kint64max);
+      } else {
+        for (std::size_t tw = 0; tw < ready.size(); ++tw) {
+          readies_.push_back(ready[tw]);
+          dues_.push_back(due[tw] < CUSTOM_MAX_INT ? due[tw] : kint64max);
+        }
+      }
+      window_starts_[i + 1] = readies_.size();
+    }
+  }
+
+private:
+  bool AcceptMove() override {
+    for (const int vehicle : touched_) {
+      if (!CheckRoute(vehicle))
+        return false;
+    }
+    return true;
+  }
+
+  //  Earliest and latest starts along the routes reaching their end
+  void OnRoutesSynchronized() override {
+    for (int vehicle = 0; vehicle < routing_.vehicles(); ++vehicle) {
+      const std::vector<int64>& route = routes_[vehicle];
+      std::vector<int64>& earliest    = earliest_starts_[vehicle];
+      std::vector<int64>& latest      = latest_starts_[vehicle];
+      earliest.assign(route.size(), kint64min);
+      latest.assign(route.size(), kint64max);
+      if (!routing_.IsEnd(route.back()))
+        continue;
+      earliest[0] = Earliest(vehicle, route[0], kint64min);
+      for (std::size_t position = 1; position < route.size(); ++position) {
+        const int64 transit = Transit(vehicle, route[position - 1], route[position]);
+        earliest[position] =
+            Earliest(vehicle, route[position], Add(earliest[position - 1], transit));
+      }
+      latest.back() = Latest(vehicle, route.back(), kint64max);
+      for (std::size_t position = route.size() - 1; position-- > 0;) {
+        const int64 transit = Transit(vehicle, route[position], route[position + 1]);
+        latest[position] =
+            Latest(vehicle, route[position], Add(latest[position + 1], -transit));
+      }
+    }
+  }
+
+  int64 Add(int64 time, int64 transit) const {
+    if (time == kint64min || time == kint64max)
+      return time;
+    return time + transit;
+  }
+
+  int64 Transit(int vehicle, int64 from, int64 to) const {
+    return data_.Vehicles().at(vehicle)->TimePlusServiceTime(manager_.IndexToNode(from),
+                                                            manager_.IndexToNode(to));
+  }
+
+  //  Earliest start from the arrival time, kint64max without any window left
+  int64 Earliest(int vehicle, int64 index, int64 time) const {
+    if (routing_.IsStart(index))
+      return std::max<int64>(
+          time, std::max<int64>(data_.Vehicles().at(vehicle)->time_start, 0));
+    if (routing_.IsEnd(index))
+      return time <= EndMax(vehicle) ? time : kint64max;
+    for (int tw = window_starts_[index]; tw < window_starts_[index + 1]; ++tw) {
+      if (dues_[tw] >= time)
+        return std::max(time, readies_[tw]);
+    }
+    return kint64max;
+  }
+
+  //  Latest start before the departure time, kint64min without any window left
+  int64 Latest(int vehicle, int64 index, int64 time) const {
+    if (routing_.IsStart(index))
+      return time;
+    if (routing_.IsEnd(index))
+      return std::min(time, EndMax(vehicle));
+    for (int tw = window_starts_[index + 1]; tw-- > window_starts_[index];) {
+      if (readies_[tw] <= time)
+        return std::min(time, dues_[tw]);
+    }
+    return kint64min;
+  }
+
+  //  ForceEnd only fixes the end on the closing, which any earlier arrival reaches
+  int64 EndMax(int vehicle) const {
+    const TSPTWDataDT::Vehicle* data_vehicle = data_.Vehicles().at(vehicle);
+    return data_vehicle->late_multiplier == 0 && data_vehicle->time_end < CUSTOM_MAX_INT
+               ? data_vehicle->time_end
+               : kint64max;
+  }
+
+  bool CheckRoute(int vehicle) const {
+    const std::vector<int64>& earliest = earliest_starts_[vehicle];
+    const std::vector<int64>& latest   = latest_starts_[vehicle];
+    if (earliest.empty() || earliest.back() == kint64min)
+      return true;
+    const int position = first_changed_[vehicle];
+    int64 index        = routes_[vehicle][position];
+    int64 time         = earliest[position];
+    for (std::size_t steps = 0; steps <= node_vehicles_.size(); ++steps) {
+      if (!Changed(index) && !IsVarSynced(index))
+        return true;
+      const int64 next = NewNext(index);
+      if (next == index)
+        return true;
+      time = Add(time, Transit(vehicle, index, next));
+      if (routing_.IsEnd(next))
+        return Earliest(vehicle, next, time) != kint64max;
+      // The route ends with its synchronized suffix
+      if (node_vehicles_[next] == vehicle &&
+          node_positions_[next] > last_changed_[vehicle])
+        return Earliest(vehicle, next, time) <= latest[node_positions_[next]];
+      time = Earliest(vehicle, next, time);
+      if (time == kint64max)
+        return false;
+      index = next;
+    }
+    return true;
+  }
+
+  const TSPTWDataDT& data_;
+  const RoutingIndexManager& manager_;
+  std::vector<int64> readies_;
+  std::vector<int64> dues_;
+  std::vector<int> window_starts_;
+  std::vector<std::vector<int64>> earliest_starts_;
+  std::vector<std::vector<int64>> latest_starts_;
+};
+} // namespace
+
+TimeWindowFilter* MakeTimeWindowFilter(const TSPTWDataDT& data,
+                                       const RoutingModel& routing,
+                                       const RoutingIndexManager& manager) {
+  return routing.solver()->RevAlloc(new TimeWindowFilter(data, routing, manager));
+}
+
+VectorCapacityFilter* MakeVectorCapacityFilter(const RoutingModel& routing,
+                                               const VectorCapacity* capacity) {
+  return routing.solver()->RevAlloc(new VectorCapacityFilter(routing, capacity));
+}
+
+RelationFilter* MakeRelationFilter(const TSPTWDataDT& data, const RoutingModel& routing,
+                                   const RoutingIndexManager& manager) {
+  return routing.solver()->RevAlloc(new RelationFilter(data, routing, manager));
+}
+
+VehicleSymmetryFilter* MakeVehicleSymmetryFilter(const TSPTWDataDT& data,
+                                                 const RoutingModel& routing) {
+  return routing.solver()->RevAlloc(new VehicleSymmetryFilter(data, routing));
+}
+} //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_FILTERS_H
@@ -0,0 +1,628 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_INSERTION_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_INSERTION_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "./tsptw_data_dt.h"
+
+#include "ortools/constraint_solver/routing_index_manager.h"
+
+DEFINE_int64(regret_insertion, 0,
+             "Regret depth of the insertion building the first solution, 0 to rely on "
+             "the first solution strategy");
+DEFINE_bool(block_insertion, true,
+            "Build the first solution of problems with sequence, order, shipment or "
+            "same route relations by inserting the linked services as blocks");
+
+namespace operations_research {
+
+//  Marks the positions k where a service opened within [ready, due] fits
+//  between the route nodes k and k + 1. Branch free so that compilers
+//  vectorize it.
+inline void TimeWindowKernel(int count, const int64* starts, const int64* ins,
+                             const int64* outs, const int64* next_latests, int64 ready,
+                             int64 due, int64* fits) {
+  for (int k = 0; k < count; ++k) {
+    const int64 arrival = starts[k] + ins[k];
+    const int64 start   = arrival > ready ? arrival : ready;
+    fits[k] |= static_cast<int64>((start <= due) & (start + outs[k] <= next_latests[k]));
+  }
+}
+
+//  Insertion deltas of a service between the route nodes k and k + 1,
+//  kint64max where it does not fit.
+inline void InsertionCostKernel(int count, int64 time_multiplier,
+                                int64 distance_multiplier, const int64* ins,
+                                const int64* outs, const int64* directs,
+                                const int64* distance_ins, const int64* distance_outs,
+                                const int64* distance_directs, const int64* fits,
+                                int64* costs) {
+  for (int k = 0; k < count; ++k) {
+    const int64 cost =
+        time_multiplier * (ins[k] + outs[k] - directs[k]) +
+        distance_multiplier * (distance_ins[k] + distance_outs[k] - distance_directs[k]);
+    costs[k] = fits[k] ? cost : kint64max;
+  }
+}
+
+//  Builds a first solution by regret insertion. At each step, the service whose
+//  best insertion loses the most over its k - 1 next best vehicles is inserted
+//  first. The best insertion of every service in every vehicle is kept and only
+//  recomputed for the vehicle which received the last service. Positions of a
+//  route are evaluated in batches over the gathered transits, with forward
+//  earliest starts and backward latest starts, so that time windows, hard
+//  capacities, route distance and vehicle compatibility are checked in constant
+//  time per position.
+//
+//  Services linked by Sequence, Order, Shipment and SameRoute relations form
+//  groups, inserted on a single vehicle as contiguous blocks in the relation
+//  order. Groups go before the regret insertion of the other services, the
+//  hardest first: fewest compatible vehicles, then tightest time windows. A
+//  group fitting in no route as a block is inserted service by service, in the
+//  relation order on the single vehicle where this costs the least, unless its
+//  services must directly follow each other (Sequence). It is only left out
+//  when no vehicle takes all its services.
+class RegretInsertion {
+public:
+  RegretInsertion(const TSPTWDataDT& data, const RoutingIndexManager& manager,
+                  int64 horizon, int64 regret)
+      : data_(data)
+      , manager_(manager)
+      , horizon_(horizon)
+      , regret_(std::max<int64>(regret, 1))
+      , size_(data.SizeMissions())
+      , size_vehicles_(data.Vehicles().size()) {}
+
+  bool Applicable() const {
+    if (size_ == 0 || size_vehicles_ == 0 || !LinkableRelations())
+      return false;
+    for (const TSPTWDataDT::Vehicle* vehicle : data_.Vehicles()) {
+      if (vehicle->free_approach || vehicle->free_return || !vehicle->rests.empty())
+        return false;
+    }
+    for (int32 activity = 0; activity <= data_.SizeProblem(); ++activity) {
+      if (data_.AlternativeSize(activity) > 1)
+        return false;
+    }
+    for (int i = 0; i < size_; ++i) {
+      for (const bool refill : data_.RefillQuantities(RoutingIndexManager::NodeIndex(i))) {
+        if (refill)
+          return false;
+      }
+    }
+    return true;
+  }
+
+  //  Whether some relation links several services
+  bool HasBlocks() const {
+    for (const TSPTWDataDT::Relation* relation : data_.Relations()) {
+      if (relation->linked_ids->size() > 1)
+        return true;
+    }
+    return false;
+  }
+
+  //  Routes of services by vehicle, as routing indices. Services fitting in no
+  //  route are left out.
+  void Build(std::vector<std::vector<int64>>* routes) {
+    Initialize();
+
+    // Linked groups as blocks, the hardest first
+    std::vector<int> blocks;
+    for (std::size_t g = 0; g < groups_.size(); ++g) {
+      if (groups_[g].size() > 1)
+        blocks.push_back(g);
+    }
+    std::stable_sort(blocks.begin(), blocks.end(), [this](int a, int b) {
+      return group_vehicles_[a] < group_vehicles_[b] ||
+             (group_vehicles_[a] == group_vehicles_[b] &&
+              group_widths_[a] < group_widths_[b]);
+    });
+    for (const int g : blocks) {
+      int vehicle = -1;
+      for (int v = 0; v < size_vehicles_; ++v) {
+        Evaluate(g, v);
+        const int64 cost = insertions_[g * size_vehicles_ + v].cost;
+        if (cost != kint64max &&
+            (vehicle < 0 || cost < insertions_[g * size_vehicles_ + vehicle].cost))
+          vehicle = v;
+      }
+      if (vehicle >= 0)
+        Insert(g, vehicle);
+      else if (group_spreads_[g])
+        InsertSpread(g);
+    }
+
+    // Other services by regret
+    std::vector<bool> pending(groups_.size(), false);
+    for (std::size_t g = 0; g < groups_.size(); ++g) {
+      if (groups_[g].size() > 1)
+        continue;
+      pending[g] = true;
+      for (int v = 0; v < size_vehicles_; ++v)
+        Evaluate(g, v);
+    }
+
+    std::vector<int64> costs(size_vehicles_);
+    while (true) {
+      int best_group    = -1;
+      int best_vehicle  = -1;
+      int64 best_regret = -1;
+      int64 best_cost   = kint64max;
+      for (std::size_t g = 0; g < groups_.size(); ++g) {
+        if (!pending[g])
+          continue;
+        int vehicle = -1;
+        costs.clear();
+        for (int v = 0; v < size_vehicles_; ++v) {
+          const int64 cost = insertions_[g * size_vehicles_ + v].cost;
+          if (cost == kint64max)
+            continue;
+          if (vehicle < 0 || cost < insertions_[g * size_vehicles_ + vehicle].cost)
+            vehicle = v;
+          costs.push_back(cost);
+        }
+        if (vehicle < 0) {
+          pending[g] = false;
+          continue;
+        }
+        const int depth = std::min<int>(regret_, costs.size());
+        std::partial_sort(costs.begin(), costs.begin() + depth, costs.end());
+        int64 regret = (regret_ - depth) * CUSTOM_MAX_INT;
+        for (int r = 1; r < depth; ++r)
+          regret += costs[r] - costs[0];
+        if (regret > best_regret || (regret == best_regret && costs[0] < best_cost)) {
+          best_group   = g;
+          best_vehicle = vehicle;
+          best_regret  = regret;
+          best_cost    = costs[0];
+        }
+      }
+      if (best_group < 0)
+        break;
+
+      Insert(best_group, best_vehicle);
+      pending[best_group] = false;
+      for (std::size_t g = 0; g < groups_.size(); ++g) {
+        if (pending[g])
+          Evaluate(g, best_vehicle);
+      }
+    }
+
+    routes->assign(size_vehicles_, std::vector<int64>());
+    for (int v = 0; v < size_vehicles_; ++v) {
+      const std::vector<int>& nodes = routes_[v].nodes;
+      for (std::size_t position = 1; position + 1 < nodes.size(); ++position)
+        (*routes)[v].push_back(
+            manager_.NodeToIndex(RoutingIndexManager::NodeIndex(nodes[position])));
+    }
+  }
+
+private:
+  struct Insertion {
+    int64 cost;
+    int position;
+  };
+
+  //  Nodes of a route from the vehicle start to its end, their earliest and
+  //  latest starts, the transits between consecutive nodes and the loads of
+  //  the hard capacities after each node.
+  struct Route {
+    std::vector<int> nodes;
+    std::vector<int64> starts;
+    std::vector<int64> latests;
+    std::vector<int64> directs;
+    std::vector<int64> distance_directs;
+    std::vector<std::vector<int64>> loads;
+    std::vector<std::vector<int64>> prefix_lows;
+    std::vector<std::vector<int64>> prefix_highs;
+    std::vector<std::vector<int64>> suffix_lows;
+    std::vector<std::vector<int64>> suffix_highs;
+    int64 distance;
+  };
+
+  //  Whether relations only link services in blocks, each service belonging
+  //  to a single relation
+  bool LinkableRelations() const {
+    std::vector<bool> linked(size_, false);
+    for (const TSPTWDataDT::Relation* relation : data_.Relations()) {
+      if (relation->type != Sequence && relation->type != Order &&
+          relation->type != Shipment && relation->type != SameRoute)
+        return false;
+      for (const std::string& linked_id : *relation->linked_ids) {
+        const int64 i = data_.IdIndex(linked_id);
+        if (i < 0)
+          continue;
+        if (i >= size_ || linked[i])
+          return false;
+        linked[i] = true;
+      }
+    }
+    return true;
+  }
+
+  void Initialize() {
+    window_starts_.assign(1, 0);
+    for (int i = 0; i < size_; ++i) {
+      const RoutingIndexManager::NodeIndex node(i);
+      const std::vector<int64> ready = data_.ReadyTime(node);
+      const std::vector<int64> due   = data_.DueTime(node);
+      const bool late                = data_.LateMultiplier(node) > 0;
+      if (ready.empty()) {
+        readies_.push_back(0);
+        dues_.push_back(horizon_);
+      }
+      for (std::size_t tw = 0; tw < ready.size(); ++tw) {
+        readies_.push_back(std::max<int64>(ready[tw], 0));
+        dues_.push_back(late || due[tw] >= CUSTOM_MAX_INT ? horizon_
+                                                          : std::min(due[tw], horizon_));
+      }
+      window_starts_.push_back(readies_.size());
+
+      const std::vector<int64> vehicle_indices = data_.VehicleIndices(node);
+      for (int v = 0; v < size_vehicles_; ++v)
+        allowed_.push_back(vehicle_indices.empty() ||
+                           std::find(vehicle_indices.begin(), vehicle_indices.end(), v) !=
+                               vehicle_indices.end());
+    }
+
+    // Linked services, then each other service alone
+    std::vector<bool> grouped(size_, false);
+    for (const TSPTWDataDT::Relation* relation : data_.Relations()) {
+      std::vector<int> group;
+      for (const std::string& linked_id : *relation->linked_ids) {
+        const int64 i = data_.IdIndex(linked_id);
+        if (i >= 0) {
+          group.push_back(i);
+          grouped[i] = true;
+        }
+      }
+      if (!group.empty()) {
+        groups_.push_back(group);
+        group_spreads_.push_back(relation->type != Sequence);
+      }
+    }
+    for (int i = 0; i < size_; ++i) {
+      if (!grouped[i]) {
+        groups_.push_back({i});
+        group_spreads_.push_back(true);
+      }
+    }
+    for (const std::vector<int>& group : groups_) {
+      int vehicles = 0;
+      for (int v = 0; v < size_vehicles_; ++v) {
+        bool allowed = true;
+        for (const int i : group)
+          allowed = allowed && allowed_[i * size_vehicles_ + v];
+        group_allowed_.push_back(allowed);
+        vehicles += allowed;
+      }
+      int64 width = horizon_;
+      for (const int i : group)
+        width = std::min(width,
+                         dues_[window_starts_[i + 1] - 1] - readies_[window_starts_[i]]);
+      group_vehicles_.push_back(vehicles);
+      group_widths_.push_back(width);
+    }
+
+    for (std::size_t unit = 0; unit < data_.Vehicles().at(0)->capacity.size(); ++unit)
+      units_.push_back(unit);
+    insertions_.assign(groups_.size() * size_vehicles_, {kint64max, -1});
+    routes_.resize(size_vehicles_);
+    for (int v = 0; v < size_vehicles_; ++v) {
+      const TSPTWDataDT::Vehicle* vehicle = data_.Vehicles().at(v);
+      routes_[v].nodes = {vehicle->start.value(), vehicle->stop.value()};
+      Update(v);
+    }
+  }
+
+  int64 Capacity(int v, std::size_t unit) const {
+    const TSPTWDataDT::Vehicle* vehicle = data_.Vehicles().at(v);
+    return vehicle->overload_multiplier[unit] == 0 && vehicle->capacity[unit] >= 0
+               ? vehicle->capacity[unit]
+               : kint64max;
+  }
+
+  int64 Transit(int v, int from, int to) const {
+    return data_.Vehicles().at(v)->TimePlusServiceTime(RoutingIndexManager::NodeIndex(from),
+                                                       RoutingIndexManager::NodeIndex(to));
+  }
+
+  int64 Distance(int v, int from, int to) const {
+    return data_.Vehicles().at(v)->Distance(RoutingIndexManager::NodeIndex(from),
+                                            RoutingIndexManager::NodeIndex(to));
+  }
+
+  int64 Quantity(std::size_t unit, int from, int to) const {
+    return data_.Quantity(unit, RoutingIndexManager::NodeIndex(from),
+                          RoutingIndexManager::NodeIndex(to));
+  }
+
+  //  Earliest start of service i reached at arrival, -1 past its windows
+  int64 EarliestStart(int i, int64 arrival) const {
+    for (int tw = window_starts_[i]; tw < window_starts_[i + 1]; ++tw) {
+      if (arrival <= dues_[tw])
+        return std::max(arrival, readies_[tw]);
+    }
+    return -1;
+  }
+
+  //  Latest start of service i leaving room until target, -1 before its windows
+  int64 LatestStart(int i, int64 target) const {
+    for (int tw = window_starts_[i + 1] - 1; tw >= window_starts_[i]; --tw) {
+      if (readies_[tw] <= target)
+        return std::min(target, dues_[tw]);
+    }
+    return -1;
+  }
+
+  //  Recomputes the schedule, loads and transits of route v
+  void Update(int v) {
+    const TSPTWDataDT::Vehicle* vehicle = data_.Vehicles().at(v);
+    Route& route                        = routes_[v];
+    const std::vector<int>& nodes       = route.nodes;
+    const int size                      = nodes.size();
+    route.starts.resize(size);
+    route.latests.resize(size);
+    route.directs.resize(size - 1);
+    route.distance_directs.resize(size - 1);
+    route.distance = 0;
+    for (int k = 0; k + 1 < size; ++k) {
+      route.directs[k]          = Transit(v, nodes[k], nodes[k + 1]);
+      route.distance_directs[k] = Distance(v, nodes[k], nodes[k + 1]);
+      route.distance += route.distance_directs[k];
+    }
+
+    route.starts[0] = std::max<int64>(vehicle->time_start, 0);
+    for (int k = 1; k + 1 < size; ++k)
+      route.starts[k] = EarliestStart(nodes[k], route.starts[k - 1] + route.directs[k - 1]);
+    route.starts[size - 1] = route.starts[size - 2] + route.directs[size - 2];
+    route.latests[size - 1] =
+        vehicle->late_multiplier == 0 && vehicle->time_end < CUSTOM_MAX_INT
+            ? std::min(vehicle->time_end, horizon_)
+            : horizon_;
+    for (int k = size - 2; k > 0; --k)
+      route.latests[k] = LatestStart(nodes[k], route.latests[k + 1] - route.directs[k]);
+    route.latests[0] = route.latests[1] - route.directs[0];
+
+    route.loads.resize(units_.size());
+    route.prefix_lows.resize(units_.size());
+    route.prefix_highs.resize(units_.size());
+    route.suffix_lows.resize(units_.size());
+    route.suffix_highs.resize(units_.size());
+    for (std::size_t unit = 0; unit < units_.size(); ++unit) {
+      std::vector<int64>& loads = route.loads[unit];
+      loads.assign(size, 0);
+      for (int k = 1; k < size; ++k)
+        loads[k] = loads[k - 1] + Quantity(unit, nodes[k - 1], nodes[k]);
+      route.prefix_lows[unit]  = loads;
+      route.prefix_highs[unit] = loads;
+      route.suffix_lows[unit]  = loads;
+      route.suffix_highs[unit] = loads;
+      for (int k = 1; k < size; ++k) {
+        route.prefix_lows[unit][k] =
+            std::min(route.prefix_lows[unit][k - 1], route.prefix_lows[unit][k]);
+        route.prefix_highs[unit][k] =
+            std::max(route.prefix_highs[unit][k - 1], route.prefix_highs[unit][k]);
+      }
+      for (int k = size - 2; k >= 0; --k) {
+        route.suffix_lows[unit][k] =
+            std::min(route.suffix_lows[unit][k + 1], route.suffix_lows[unit][k]);
+        route.suffix_highs[unit][k] =
+            std::max(route.suffix_highs[unit][k + 1], route.suffix_highs[unit][k]);
+      }
+    }
+  }
+
+  //  Best insertion of group g in route v
+  void Evaluate(int g, int v) {
+    Insertion& insertion = insertions_[g * size_vehicles_ + v];
+    insertion            = {kint64max, -1};
+    if (!group_allowed_[g * size_vehicles_ + v])
+      return;
+    if (groups_[g].size() > 1)
+      EvaluateBlock(g, v);
+    else
+      insertion = EvaluateService(groups_[g], v, 0);
+  }
+
+  //  Best insertion of the single service in route v after position from
+  Insertion EvaluateService(const std::vector<int>& service, int v, int from) {
+    Insertion insertion                 = {kint64max, -1};
+    const int i                         = service.front();
+    const TSPTWDataDT::Vehicle* vehicle = data_.Vehicles().at(v);
+    const Route& route                  = routes_[v];
+    const std::vector<int>& nodes       = route.nodes;
+    const int count                     = nodes.size() - 1;
+
+    ins_.resize(count);
+    outs_.resize(count);
+    distance_ins_.resize(count);
+    distance_outs_.resize(count);
+    costs_.resize(count);
+    fits_.assign(count, 0);
+    for (int k = 0; k < count; ++k) {
+      ins_[k]           = Transit(v, nodes[k], i);
+      outs_[k]          = Transit(v, i, nodes[k + 1]);
+      distance_ins_[k]  = Distance(v, nodes[k], i);
+      distance_outs_[k] = Distance(v, i, nodes[k + 1]);
+    }
+    for (int tw = window_starts_[i]; tw < window_starts_[i + 1]; ++tw)
+      TimeWindowKernel(count, route.starts.data(), ins_.data(), outs_.data(),
+                       route.latests.data() + 1, readies_[tw], dues_[tw], fits_.data());
+    InsertionCostKernel(count, vehicle->cost_time_multiplier,
+                        vehicle->cost_distance_multiplier, ins_.data(), outs_.data(),
+                        route.directs.data(), distance_ins_.data(), distance_outs_.data(),
+                        route.distance_directs.data(), fits_.data(), costs_.data());
+
+    const int64 fixed = count == 1 ? vehicle->cost_fixed : 0;
+    for (int k = from; k < count; ++k) {
+      if (costs_[k] == kint64max || costs_[k] + fixed >= insertion.cost)
+        continue;
+      const int64 start = EarliestStart(i, route.starts[k] + ins_[k]);
+      if (Fits(service, v, k, distance_ins_[k] + distance_outs_[k], start + outs_[k]))
+        insertion = {costs_[k] + fixed, k};
+    }
+    return insertion;
+  }
+
+  //  Best insertion of the linked services of group g as a block in route v
+  void EvaluateBlock(int g, int v) {
+    Insertion& insertion                = insertions_[g * size_vehicles_ + v];
+    const std::vector<int>& services    = groups_[g];
+    const TSPTWDataDT::Vehicle* vehicle = data_.Vehicles().at(v);
+    const Route& route                  = routes_[v];
+    const std::vector<int>& nodes       = route.nodes;
+    const int count                     = nodes.size() - 1;
+    const int first                     = services.front();
+    const int last                      = services.back();
+
+    ins_.resize(services.size());
+    int64 transit  = 0;
+    int64 distance = 0;
+    for (std::size_t j = 1; j < services.size(); ++j) {
+      ins_[j] = Transit(v, services[j - 1], services[j]);
+      transit += ins_[j];
+      distance += Distance(v, services[j - 1], services[j]);
+    }
+
+    const int64 fixed = count == 1 ? vehicle->cost_fixed : 0;
+    for (int k = 0; k < count; ++k) {
+      const int64 in  = Transit(v, nodes[k], first);
+      const int64 out = Transit(v, last, nodes[k + 1]);
+      const int64 distance_delta =
+          Distance(v, nodes[k], first) + distance + Distance(v, last, nodes[k + 1]);
+      const int64 cost =
+          vehicle->cost_time_multiplier * (in + transit + out - route.directs[k]) +
+          vehicle->cost_distance_multiplier *
+              (distance_delta - route.distance_directs[k]) +
+          fixed;
+      if (cost >= insertion.cost)
+        continue;
+      int64 start = EarliestStart(first, route.starts[k] + in);
+      for (std::size_t j = 1; j < services.size() && start >= 0; ++j)
+        start = EarliestStart(services[j], start + ins_[j]);
+      if (start < 0 || start + out > route.latests[k + 1])
+        continue;
+      if (Fits(services, v, k, distance_delta, start + out))
+        insertion = {cost, k};
+    }
+  }
+
+  //  Capacity, distance and duration checks of services inserted in a row after
+  //  position k, reaching the next node at arrival
+  bool Fits(const std::vector<int>& services, int v, int k, int64 distance_delta,
+            int64 arrival) const {
+    const TSPTWDataDT::Vehicle* vehicle = data_.Vehicles().at(v);
+    const Route& route                  = routes_[v];
+    const std::vector<int>& nodes       = route.nodes;
+
+    if (vehicle->distance > 0 &&
+        route.distance + distance_delta - route.distance_directs[k] > vehicle->distance)
+      return false;
+
+    if (vehicle->duration >= 0) {
+      const int64 delay = std::max<int64>(arrival - route.starts[k + 1], 0);
+      if (route.starts.back() + delay - route.starts[0] > vehicle->duration)
+        return false;
+    }
+
+    for (std::size_t unit = 0; unit < units_.size(); ++unit) {
+      const int64 capacity = Capacity(v, unit);
+      if (capacity == kint64max)
+        continue;
+      int64 load = route.loads[unit][k] + Quantity(unit, nodes[k], services.front());
+      int64 high = std::max(route.prefix_highs[unit][k], load);
+      int64 low  = std::min(route.prefix_lows[unit][k], load);
+      for (std::size_t j = 1; j < services.size(); ++j) {
+        load += Quantity(unit, services[j - 1], services[j]);
+        high = std::max(high, load);
+        low  = std::min(low, load);
+      }
+      const int64 shift = load + Quantity(unit, services.back(), nodes[k + 1]) -
+                          route.loads[unit][k + 1];
+      high = std::max(high, route.suffix_highs[unit][k + 1] + shift);
+      low  = std::min(low, route.suffix_lows[unit][k + 1] + shift);
+      if (high - low > capacity)
+        return false;
+    }
+    return true;
+  }
+
+  void Insert(int g, int v) {
+    const Insertion& insertion = insertions_[g * size_vehicles_ + v];
+    std::vector<int>& nodes    = routes_[v].nodes;
+    nodes.insert(nodes.begin() + insertion.position + 1, groups_[g].begin(),
+                 groups_[g].end());
+    Update(v);
+  }
+
+  //  Inserts the services of group g one at a time in the relation order, each
+  //  one at its cheapest position after the previous one, in the route where
+  //  they all fit at the least cost. The group is left out otherwise.
+  void InsertSpread(int g) {
+    int best_vehicle = -1;
+    int64 best_cost  = kint64max;
+    std::vector<int> best_nodes;
+    for (int v = 0; v < size_vehicles_; ++v) {
+      if (!group_allowed_[g * size_vehicles_ + v])
+        continue;
+      const Route route = routes_[v];
+      int64 cost        = 0;
+      int from          = 0;
+      for (const int i : groups_[g]) {
+        const Insertion insertion = EvaluateService({i}, v, from);
+        if (insertion.cost == kint64max) {
+          cost = kint64max;
+          break;
+        }
+        cost += insertion.cost;
+        from = insertion.position + 1;
+        routes_[v].nodes.insert(routes_[v].nodes.begin() + from, i);
+        Update(v);
+      }
+      if (cost < best_cost) {
+        best_vehicle = v;
+        best_cost    = cost;
+        best_nodes   = routes_[v].nodes;
+      }
+      routes_[v] = route;
+    }
+    if (best_vehicle >= 0) {
+      routes_[best_vehicle].nodes.swap(best_nodes);
+      Update(best_vehicle);
+    }
+  }
+
+  const TSPTWDataDT& data_;
+  const RoutingIndexManager& manager_;
+  const int64 horizon_;
+  const int64 regret_;
+  const int size_;
+  const int size_vehicles_;
+
+  std::vector<int64> readies_;
+  std::vector<int64> dues_;
+  std::vector<int> window_starts_;
+  std::vector<bool> allowed_;
+  std::vector<std::vector<int>> groups_;
+  std::vector<bool> group_allowed_;
+  std::vector<bool> group_spreads_;
+  std::vector<int> group_vehicles_;
+  std::vector<int64> group_widths_;
+  std::vector<std::size_t> units_;
+  std::vector<Insertion> insertions_;
+  std::vector<Route> routes_;
+
+  std::vector<int64> ins_;
+  std::vector<int64> outs_;
+  std::vector<int64> distance_ins_;
+  std::vector<int64> distance_outs_;
+  std::vector<int64> costs_;
+  std::vector<int64> fits_;
+};
+} //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_INSERTION_H
@@ -1,16 +1,20 @@
 #ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_LIMITS_H
 #define OR_TOOLS_TUTORIALS_CPLUSPLUS_LIMITS_H
 
+#include <algorithm>
 #include <chrono>
 #include <iomanip>
 #include <ostream>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "./ortools_result.pb.h"
 
+#include "./scheduler.h"
 #include "./tsptw_data_dt.h"
 
 #include "ortools/base/bitmap.h"
@@ -24,11 +28,29 @@ DEFINE_int64(no_solution_improvement_limit, -1, "Iterations whitout improvement"
 DEFINE_int64(minimum_duration, -1, "Initial time whitout improvement in ms");
 DEFINE_int64(init_duration, -1, "Maximum duration to find a first solution");
 DEFINE_int64(time_out_multiplier, 2, "Multiplier for the nexts time out");
-DEFINE_int64(vehicle_limit, 0, "Define the maximum number of vehicle");
 DEFINE_int64(solver_parameter, -1, "Force a particular behavior");
 DEFINE_bool(only_first_solution, false, "Compute only the first solution");
 DEFINE_bool(balance, false, "Route balancing");
 DEFINE_bool(nearby, false, "Short segment priority");
+DEFINE_bool(tighten_time_windows, true,
+            "Tighten time windows with the travel bounds from and to the depots");
+DEFINE_int64(tighten_time_windows_size, 2000,
+             "Number of services up to which time windows are tightened on dense "
+             "matrices, whose travel bounds take a quadratic pass per depot pair");
+DEFINE_bool(multilevel, false,
+            "Solve a coarsened problem first then refine it level by level");
+DEFINE_int64(multilevel_coarsest_size, 1000,
+             "Number of services under which the problem is no longer coarsened");
+DEFINE_bool(benchmark_transits, false,
+            "Time transit callback lookups between close nodes before solving");
+DEFINE_bool(restrict_to_sparse_arcs, true,
+            "With sparse matrices, only consider successors among the stored neighbours");
+DEFINE_bool(post_solve_schedule, true,
+            "Compute times and quantities of the final routes instead of finalizing "
+            "them within the search, when they have no effect on the cost");
+DEFINE_bool(vector_capacity, false,
+            "Check all capacity units in a single constraint instead of one dimension "
+            "per unit");
 #ifdef DEBUG
 DEFINE_bool(debug, true, "debug display");
 #else
@@ -45,21 +67,54 @@ DEFINE_string(routing_search_parameters,
               "Text proto RoutingSearchParameters (possibly partial) that will "
               "override the DefaultRoutingSearchParameters()");
 
-const char* kDistance        = "distance";
-const char* kDistanceBalance = "distance_balance";
-const char* kDistanceOrder   = "distance_order";
-const char* kFakeDistance    = "fake_distance";
+const char* kBalance       = "balance";
+const char* kDistance      = "distance";
+const char* kDistanceOrder = "distance_order";
+const char* kFakeDistance  = "fake_distance";
+const char* kLateness      = "lateness";
+const char* kOverload      = "overload";
 
 const char* kFakeTime       = "fake_time";
 const char* kFakeTimeNoWait = "fake_time_without_wait";
 const char* kTime           = "time";
-const char* kTimeBalance    = "time_balance";
 const char* kTimeNoWait     = "time_without_wait";
 const char* kTimeOrder      = "time_order";
 
 const char* kValue = "value";
 
 namespace operations_research {
+//  Balance spreads depend on the times of every vehicle
+bool PostSolveSchedule() { return FLAGS_post_solve_schedule && !FLAGS_balance; }
+
+// Vehicles removed by the fleet reduction get back their position, with an empty route
+void RestoreVehiclePositions(const TSPTWDataDT& data, ortools_result::Result* result) {
+  if (data.RemovedVehicles().empty())
+    return;
+  google::protobuf::RepeatedPtrField<ortools_result::Route> routes;
+  routes.Swap(result->mutable_routes());
+  for (int32 position = 0; position < data.SizeProblemVehicles(); ++position)
+    result->add_routes();
+  for (int v = 0; v < routes.size(); ++v)
+    result->mutable_routes(data.VehiclePosition(v))->Swap(routes.Mutable(v));
+  // Removed vehicles are identical to kept ones, they share the depot nodes
+  const TSPTWDataDT::Vehicle* vehicle = data.Vehicles().at(0);
+  for (const auto& removed_vehicle : data.RemovedVehicles()) {
+    ortools_result::Route* route = result->mutable_routes(removed_vehicle.first);
+    ortools_result::Activity* start_activity = route->add_activities();
+    start_activity->set_index(data.ProblemIndex(vehicle->start));
+    start_activity->set_start_time(removed_vehicle.second);
+    start_activity->set_current_distance(0);
+    start_activity->set_type("start");
+    for (std::size_t q = 0; q < vehicle->capacity.size(); ++q)
+      start_activity->add_quantities(0);
+    ortools_result::Activity* end_activity = route->add_activities();
+    end_activity->set_index(data.ProblemIndex(vehicle->stop));
+    end_activity->set_start_time(removed_vehicle.second);
+    end_activity->set_current_distance(0);
+    end_activity->set_type("end");
+  }
+}
+
 namespace {
 
 //  Don't use this class within a MakeLimit factory method!
@@ -197,6 +252,362 @@ MakeNoImprovementLimit(Solver* const solver, IntVar* const objective_var,
                                                  time_out_coef, init_duration, minimize));
 }
 
+//  Replaces the last activity of the route, an aggregated node, by one activity per
+//  service. Services follow each other at the node location, quantities are read
+//  before or after the node.
+void ExpandAggregatedActivity(const TSPTWDataDT& data, int vehicle,
+                              RoutingIndexManager::NodeIndex node, bool quantities_after,
+                              ortools_result::Route* route) {
+  const std::vector<TSPTWDataDT::AggregatedService>& services =
+      data.AggregatedServices(node);
+  if (services.empty())
+    return;
+
+  const ortools_result::Activity node_activity =
+      route->activities(route->activities_size() - 1);
+  route->mutable_activities()->RemoveLast();
+
+  std::vector<double> quantities(node_activity.quantities().begin(),
+                                 node_activity.quantities().end());
+  const std::vector<int64> node_quantities = data.Quantities(node);
+  if (quantities_after) {
+    for (std::size_t q = 0; q < quantities.size() && q < node_quantities.size(); ++q)
+      quantities[q] -= node_quantities[q];
+  }
+
+  int64 start_time = node_activity.start_time();
+  for (const TSPTWDataDT::AggregatedService& service : services) {
+    ortools_result::Activity* activity = route->add_activities();
+    *activity                          = node_activity;
+    activity->set_id(service.service_id);
+    activity->set_index(service.problem_index);
+    activity->set_alternative(0);
+    activity->set_start_time(start_time);
+    for (std::size_t q = 0; q < quantities.size() && q < service.quantities.size(); ++q) {
+      if (quantities_after)
+        quantities[q] += service.quantities[q];
+      activity->set_quantities(q, quantities[q]);
+      if (!quantities_after)
+        quantities[q] += service.quantities[q];
+    }
+    start_time += data.Vehicles().at(vehicle)->coef_service * service.service_time;
+  }
+}
+
+//  Appends the activities of a route given by its routing indices, from the
+//  vehicle start to its end. Rests, sorted by start time, are taken before the
+//  first service starting after them. Quantities are those after each service.
+//  Returns the distance of the route.
+int64 AddRouteActivities(const TSPTWDataDT& data, const RoutingIndexManager& manager,
+                         int vehicle, const std::vector<int64>& route,
+                         const std::vector<int64>& start_times,
+                         const std::vector<std::vector<int64>>& quantities,
+                         const std::vector<std::pair<int64, std::string>>& rests,
+                         ortools_result::Route* result_route) {
+  const TSPTWDataDT::Vehicle* data_vehicle = data.Vehicles().at(vehicle);
+  std::size_t rest                         = 0;
+  int64 current_distance                   = 0;
+  for (std::size_t position = 0; position < route.size(); ++position) {
+    while (position > 0 && rest < rests.size() &&
+           (rests[rest].first <= start_times[position] || position + 1 == route.size())) {
+      ortools_result::Activity* activity = result_route->add_activities();
+      activity->set_type("break");
+      activity->set_id(rests[rest].second);
+      activity->set_start_time(rests[rest].first);
+      ++rest;
+    }
+
+    const RoutingIndexManager::NodeIndex node = manager.IndexToNode(route[position]);
+    ortools_result::Activity* activity        = result_route->add_activities();
+    activity->set_index(data.ProblemIndex(node));
+    activity->set_start_time(start_times[position]);
+    activity->set_current_distance(current_distance);
+    if (position + 1 == route.size()) {
+      activity->set_type("end");
+      break;
+    }
+    if (position == 0) {
+      activity->set_type("start");
+    } else {
+      activity->set_type("service");
+      activity->set_id(data.ServiceId(node));
+      activity->set_alternative(data.ServedAlternativeIndex(node, start_times[position]));
+    }
+    for (std::size_t q = 0; q < quantities.size(); ++q)
+      activity->add_quantities(quantities[q][position + 1]);
+    if (position > 0)
+      ExpandAggregatedActivity(data, vehicle, node, true, result_route);
+    current_distance +=
+        data_vehicle->Distance(node, manager.IndexToNode(route[position + 1]));
+  }
+  return current_distance;
+}
+
+//  Rest interval of a vehicle with its id, resolved when the interval is built
+struct StoredRest {
+  StoredRest(IntervalVar* i, const std::string& id)
+      : interval(i)
+      , rest_id(id) {}
+  IntervalVar* interval;
+  std::string rest_id;
+};
+
+//  Fills the routes of a result from a solution, or from the current variable
+//  values within the search. Dimensions are resolved once, rests are ordered by
+//  start time, and route buffers are kept from one extraction to the next.
+class RouteExtractor {
+public:
+  RouteExtractor(const TSPTWDataDT& data, const RoutingModel& routing,
+                 const RoutingIndexManager& manager,
+                 std::vector<std::vector<StoredRest>> stored_rests)
+      : data_(data)
+      , routing_(routing)
+      , manager_(manager)
+      , stored_rests_(std::move(stored_rests))
+      , scheduler_(data, manager, PostSolveSchedule())
+      , time_dimension_(routing.GetMutableDimension(kTime))
+      , distance_dimension_(routing.GetMutableDimension(kDistance))
+      , service_counts_(routing.vehicles(), 0)
+      , solution_(nullptr) {
+    for (std::size_t q = 0;
+         q < data.Quantities(RoutingIndexManager::NodeIndex(0)).size(); ++q)
+      quantity_dimensions_.push_back(
+          routing.GetMutableDimension("quantity" + std::to_string(q)));
+  }
+
+  //  Without solution, values are the minimums of the variables. Quantities
+  //  are those after each service in the final result, before it otherwise.
+  void Extract(const Assignment* solution, bool quantities_after,
+               ortools_result::Result* result) {
+    solution_ = solution;
+    if (result->routes_size() > 0)
+      result->clear_routes();
+    for (int vehicle = 0; vehicle < routing_.vehicles(); ++vehicle)
+      ExtractRoute(vehicle, quantities_after, result->add_routes());
+    solution_ = nullptr;
+  }
+
+  //  Services of the vehicle in the last extraction
+  int ServiceCount(int vehicle) const { return service_counts_[vehicle]; }
+
+private:
+  int64 Min(IntVar* var) const {
+    return solution_ != nullptr ? solution_->Min(var) : var->Min();
+  }
+
+  int64 NextValue(int64 index) const {
+    return solution_ != nullptr ? solution_->Value(routing_.NextVar(index))
+                                : routing_.NextVar(index)->Value();
+  }
+
+  int64 StartTime(const std::vector<int64>& start_times, std::size_t position) const {
+    return start_times.empty() ? Min(time_dimension_->CumulVar(route_[position]))
+                               : start_times[position];
+  }
+
+  //  Performed rests of the vehicle, by start time
+  void SortRests(int vehicle) {
+    rests_.clear();
+    for (const StoredRest& rest : stored_rests_[vehicle]) {
+      IntervalVar* const interval = rest.interval;
+      if (solution_ != nullptr && solution_->PerformedValue(interval))
+        rests_.emplace_back(solution_->StartValue(interval), &rest);
+      else if (solution_ == nullptr && interval->StartMin() == interval->StartMax())
+        rests_.emplace_back(interval->StartMin(), &rest);
+    }
+    std::stable_sort(rests_.begin(), rests_.end(),
+                     [](const std::pair<int64, const StoredRest*>& a,
+                        const std::pair<int64, const StoredRest*>& b) {
+                       return a.first < b.first;
+                     });
+  }
+
+  void AddRest(const std::pair<int64, const StoredRest*>& rest,
+               ortools_result::Route* route) const {
+    ortools_result::Activity* activity = route->add_activities();
+    activity->set_type("break");
+    activity->set_id(rest.second->rest_id);
+    activity->set_start_time(rest.first);
+  }
+
+  void ExtractRoute(int vehicle, bool quantities_after, ortools_result::Route* route) {
+    route_.clear();
+    for (int64 index = routing_.Start(vehicle); !routing_.IsEnd(index);
+         index       = NextValue(index))
+      route_.push_back(index);
+    route_.push_back(routing_.End(vehicle));
+    service_counts_[vehicle] = route_.size() - 2;
+
+    // Rests stay where the search put them, services are scheduled around them
+    SortRests(vehicle);
+    std::vector<int64> start_times;
+    if (rests_.size() == stored_rests_[vehicle].size()) {
+      rest_intervals_.clear();
+      for (const std::pair<int64, const StoredRest*>& rest : rests_)
+        rest_intervals_.emplace_back(rest.first, rest.second->interval->DurationMin());
+      start_times = scheduler_.StartTimes(vehicle, route_, rest_intervals_);
+    }
+    std::vector<std::vector<int64>> quantities;
+    if (scheduler_.Enabled() || FLAGS_vector_capacity)
+      quantities = scheduler_.Quantities(route_);
+
+    std::size_t rest = 0;
+    for (std::size_t position = 0; position + 1 < route_.size(); ++position) {
+      const int64 index      = route_[position];
+      const int64 start_time = StartTime(start_times, position);
+      // Rests taken on the way to the service
+      while (position > 0 && rest < rests_.size() && rests_[rest].first <= start_time)
+        AddRest(rests_[rest++], route);
+
+      ortools_result::Activity* activity       = route->add_activities();
+      RoutingIndexManager::NodeIndex nodeIndex = manager_.IndexToNode(index);
+      activity->set_index(data_.ProblemIndex(nodeIndex));
+      activity->set_start_time(start_time);
+      activity->set_current_distance(Min(distance_dimension_->CumulVar(index)));
+      if (position == 0) {
+        activity->set_type("start");
+      } else {
+        activity->set_type("service");
+        activity->set_id(data_.ServiceId(nodeIndex));
+        activity->set_alternative(data_.ServedAlternativeIndex(nodeIndex, start_time));
+      }
+      const std::size_t quantity_position = quantities_after ? position + 1 : position;
+      for (std::size_t q = 0; q < quantity_dimensions_.size(); ++q) {
+        activity->add_quantities(
+            quantities.empty()
+                ? Min(quantity_dimensions_[q]->CumulVar(route_[quantity_position]))
+                : quantities[q][quantity_position]);
+      }
+      if (position > 0)
+        ExpandAggregatedActivity(data_, vehicle, nodeIndex, quantities_after, route);
+    }
+    while (rest < rests_.size())
+      AddRest(rests_[rest++], route);
+
+    ortools_result::Activity* end_activity = route->add_activities();
+    end_activity->set_index(data_.ProblemIndex(manager_.IndexToNode(route_.back())));
+    end_activity->set_start_time(StartTime(start_times, route_.size() - 1));
+    end_activity->set_current_distance(
+        Min(distance_dimension_->CumulVar(route_.back())));
+    end_activity->set_type("end");
+  }
+
+  const TSPTWDataDT& data_;
+  const RoutingModel& routing_;
+  const RoutingIndexManager& manager_;
+  const std::vector<std::vector<StoredRest>> stored_rests_;
+  const RouteScheduler scheduler_;
+  RoutingDimension* const time_dimension_;
+  RoutingDimension* const distance_dimension_;
+  std::vector<RoutingDimension*> quantity_dimensions_;
+  std::vector<int> service_counts_;
+  std::vector<int64> route_;
+  std::vector<std::pair<int64, const StoredRest*>> rests_;
+  std::vector<std::pair<int64, int64>> rest_intervals_;
+  const Assignment* solution_;
+};
+
+//  Cost components of a solution, or of the current variable values within the
+//  search. Span coefficients and cumul variables of every dimension are read
+//  once, so a breakdown only walks the vehicles. Costs are unscaled.
+class CostBreakdown {
+public:
+  explicit CostBreakdown(const RoutingModel& routing)
+      : routing_(routing)
+      , solution_(nullptr) {
+    for (const char* name :
+         {kTime, kDistance, kTimeNoWait, kValue, kTimeOrder, kDistanceOrder})
+      spans_.push_back(SpanCost(routing, name));
+    RoutingDimension* const balance_dimension = routing.GetMutableDimension(kBalance);
+    // Spreads are carried by the first two vehicles of the balance dimension
+    for (int vehicle = 0; vehicle < 2 && balance_dimension != nullptr &&
+                          vehicle < routing.vehicles();
+         ++vehicle) {
+      const int64 end_index = routing.End(vehicle);
+      balances_.push_back(
+          {balance_dimension->CumulVar(end_index),
+           balance_dimension->GetCumulVarSoftUpperBound(end_index),
+           balance_dimension->GetCumulVarSoftUpperBoundCoefficient(end_index)});
+    }
+    for (int vehicle = 0; vehicle < routing.vehicles(); ++vehicle)
+      fixed_costs_.push_back(routing.GetFixedCostOfVehicle(vehicle));
+  }
+
+  //  Without solution, values are the bounds of the variables
+  void Fill(const Assignment* solution, ortools_result::CostDetails* details) {
+    solution_ = solution;
+    double fixed = 0;
+    for (int vehicle = 0; vehicle < routing_.vehicles(); ++vehicle) {
+      if (!routing_.IsEnd(Min(routing_.NextVar(routing_.Start(vehicle)))))
+        fixed += fixed_costs_[vehicle] / CUSTOM_BIGNUM;
+    }
+    details->set_fixed(fixed);
+    details->set_time(Total(spans_[0]));
+    details->set_distance(Total(spans_[1]));
+    details->set_time_without_wait(Total(spans_[2]));
+    details->set_value(Total(spans_[3]));
+    details->set_time_order(Total(spans_[4]));
+    details->set_distance_order(Total(spans_[5]));
+    details->set_time_balance(balances_.size() > 0 ? Excess(balances_[0]) : 0);
+    details->set_distance_balance(balances_.size() > 1 ? Excess(balances_[1]) : 0);
+    solution_ = nullptr;
+  }
+
+private:
+  //  Span coefficient and bounding cumuls of each vehicle, empty without the
+  //  dimension
+  struct SpanCost {
+    SpanCost(const RoutingModel& routing, const std::string& name) {
+      RoutingDimension* const dimension = routing.GetMutableDimension(name);
+      if (dimension == nullptr)
+        return;
+      for (int vehicle = 0; vehicle < routing.vehicles(); ++vehicle) {
+        coefficients.push_back(dimension->GetSpanCostCoefficientForVehicle(vehicle));
+        starts.push_back(dimension->CumulVar(routing.Start(vehicle)));
+        ends.push_back(dimension->CumulVar(routing.End(vehicle)));
+      }
+    }
+    std::vector<int64> coefficients;
+    std::vector<IntVar*> starts;
+    std::vector<IntVar*> ends;
+  };
+
+  struct SoftBound {
+    IntVar* cumul;
+    int64 bound;
+    int64 coefficient;
+  };
+
+  int64 Min(IntVar* var) const {
+    return solution_ != nullptr ? solution_->Min(var) : var->Min();
+  }
+
+  int64 Max(IntVar* var) const {
+    return solution_ != nullptr ? solution_->Max(var) : var->Max();
+  }
+
+  double Total(const SpanCost& span) const {
+    double total = 0;
+    for (std::size_t vehicle = 0; vehicle < span.coefficients.size(); ++vehicle) {
+      if (span.coefficients[vehicle] != 0)
+        total += (Min(span.ends[vehicle]) - Max(span.starts[vehicle])) *
+                 span.coefficients[vehicle] / CUSTOM_BIGNUM;
+    }
+    return total;
+  }
+
+  double Excess(const SoftBound& balance) const {
+    return std::max<int64>(Min(balance.cumul) - balance.bound, 0) * balance.coefficient /
+           CUSTOM_BIGNUM;
+  }
+
+  const RoutingModel& routing_;
+  std::vector<SpanCost> spans_;
+  std::vector<SoftBound> balances_;
+  std::vector<int64> fixed_costs_;
+  const Assignment* solution_;
+};
+
 namespace {
 
 //  Don't use this class within a MakeLimit factory method!
@@ -205,7 +616,7 @@ public:
   LoggerMonitor(const TSPTWDataDT& data, RoutingModel* routing,
                 RoutingIndexManager* manager, int64 min_start, int64 size_matrix,
                 bool debug, bool intermediate, ortools_result::Result* result,
-                std::vector<std::vector<IntervalVar*>> stored_rests, std::string filename,
+                RouteExtractor* extractor, std::string filename,
                 const bool minimize = true)
       : SearchMonitor(routing->solver())
       , data_(data)
@@ -224,7 +635,8 @@ public:
       , prototype_(new Assignment(solver_))
       , filename_(filename)
       , result_(result)
-      , stored_rests_(stored_rests) {
+      , extractor_(extractor)
+      , costs_(*routing) {
     if (minimize_) {
       best_result_ = kint64max;
     } else {
@@ -252,21 +664,6 @@ public:
     return false;
   }
 
-  inline double GetSpanCostForVehicleForDimension(int vehicle,
-                                                  const std::string& dimension_name) {
-    if (routing_->GetMutableDimension(dimension_name) == nullptr)
-      return 0;
-    return (routing_->GetMutableDimension(dimension_name)
-                ->CumulVar(routing_->End(vehicle))
-                ->Min() -
-            routing_->GetMutableDimension(dimension_name)
-                ->CumulVar(routing_->Start(vehicle))
-                ->Max()) *
-           routing_->GetMutableDimension(dimension_name)
-               ->GetSpanCostCoefficientForVehicle(vehicle) /
-           CUSTOM_BIGNUM;
-  }
-
   virtual bool AtSolution() {
     prototype_->Store();
     bool new_best = false;
@@ -275,140 +672,19 @@ public:
     if (minimize_ && objective->Min() * 1.01 < best_result_) {
       best_result_ = objective->Min();
       if (intermediate_) {
-        if (result_->routes_size() > 0)
-          result_->clear_routes();
-
-        double total_fake_time_cost(0.0), total_fake_distance_cost(0.0),
-            total_time_cost(0.0), total_distance_cost(0.0), total_time_balance_cost(0.0),
-            total_distance_balance_cost(0.0), total_time_without_wait_cost(0.0),
-            total_value_cost(0.0), total_vehicle_fixed_cost(0.0),
-            total_time_order_cost(0.0), total_distance_order_cost(0.0);
-
         int nbr_routes(0), nbr_services_served(0);
 
+        extractor_->Extract(nullptr, false, result_);
         for (int route_nbr = 0; route_nbr < routing_->vehicles(); route_nbr++) {
-          std::vector<IntervalVar*> rests = stored_rests_.at(route_nbr);
-          ortools_result::Route* route    = result_->add_routes();
-          int previous_index              = -1;
-          int64 previous_start_time       = 0;
-          bool vehicle_used               = false;
-          for (int64 index = routing_->Start(route_nbr); !routing_->IsEnd(index);
-               index       = routing_->NextVar(index)->Value()) {
-            for (std::vector<IntervalVar*>::iterator it = rests.begin();
-                 it != rests.end();) {
-              int64 rest_start_time = (*it)->StartMin();
-              if ((*it)->StartMin() == (*it)->StartMax() && previous_index != -1 &&
-                  rest_start_time >= previous_start_time &&
-                  rest_start_time <=
-                      routing_->GetMutableDimension(kTime)->CumulVar(index)->Min()) {
-                std::stringstream ss((*it)->name());
-                std::string item;
-                std::vector<std::string> parsed_name;
-                while (std::getline(ss, item, '/')) {
-                  parsed_name.push_back(item);
-                }
-
-                ortools_result::Activity* rest = route->add_activities();
-                rest->set_type("break");
-                rest->set_id(parsed_name[1]);
-                rest->set_start_time(rest_start_time);
-                it = rests.erase(it);
-              } else {
-                ++it;
-              }
-            }
-            ortools_result::Activity* activity       = route->add_activities();
-            RoutingIndexManager::NodeIndex nodeIndex = manager_->IndexToNode(index);
-            activity->set_index(data_.ProblemIndex(nodeIndex));
-            activity->set_start_time(
-                routing_->GetMutableDimension(kTime)->CumulVar(index)->Min());
-            activity->set_current_distance(
-                routing_->GetMutableDimension(kDistance)->CumulVar(index)->Min());
-            if (previous_index == -1)
-              activity->set_type("start");
-            else {
-              ++nbr_services_served;
-              vehicle_used = true;
-              activity->set_type("service");
-              activity->set_index(data_.ProblemIndex(nodeIndex));
-              activity->set_alternative(data_.AlternativeIndex(nodeIndex));
-            }
-            for (std::size_t q = 0;
-                 q < data_.Quantities(RoutingIndexManager::NodeIndex(0)).size(); ++q) {
-              double exchange =
-                  routing_->GetMutableDimension("quantity" + std::to_string(q))
-                      ->CumulVar(index)
-                      ->Min();
-              activity->add_quantities(exchange);
-            }
-            previous_index = index;
-          }
-
-          for (std::vector<IntervalVar*>::iterator it = rests.begin(); it != rests.end();
-               ++it) {
-            int64 rest_start_time = (*it)->StartMin();
-            if ((*it)->StartMin() == (*it)->StartMax()) {
-              std::stringstream ss((*it)->name());
-              std::string item;
-              std::vector<std::string> parsed_name;
-              while (std::getline(ss, item, '/')) {
-                parsed_name.push_back(item);
-              }
-
-              ortools_result::Activity* rest = route->add_activities();
-              rest->set_type("break");
-              rest->set_id(parsed_name[1]);
-              rest->set_start_time(rest_start_time);
-            }
-          }
-
-          ortools_result::Activity* end_activity = route->add_activities();
-          RoutingIndexManager::NodeIndex nodeIndex =
-              manager_->IndexToNode(routing_->End(route_nbr));
-          end_activity->set_index(data_.ProblemIndex(nodeIndex));
-          end_activity->set_start_time(routing_->GetMutableDimension(kTime)
-                                           ->CumulVar(routing_->End(route_nbr))
-                                           ->Min());
-          end_activity->set_current_distance(routing_->GetMutableDimension(kDistance)
-                                                 ->CumulVar(routing_->End(route_nbr))
-                                                 ->Min());
-          end_activity->set_type("end");
-
-          if (FLAGS_nearby) {
-            total_time_order_cost +=
-                GetSpanCostForVehicleForDimension(route_nbr, kTimeOrder);
-            total_distance_order_cost +=
-                GetSpanCostForVehicleForDimension(route_nbr, kDistanceOrder);
-          }
-
-          if (FLAGS_debug) {
-            if (vehicle_used) {
-              ++nbr_routes;
-              total_vehicle_fixed_cost +=
-                  routing_->GetFixedCostOfVehicle(route_nbr) / CUSTOM_BIGNUM;
-            }
-            total_time_cost += GetSpanCostForVehicleForDimension(route_nbr, kTime);
-            total_distance_cost +=
-                GetSpanCostForVehicleForDimension(route_nbr, kDistance);
-            // total_fake_time_cost +=
-            //     GetSpanCostForVehicleForDimension(route_nbr, kFakeTime);
-            // total_fake_distance_cost +=
-            //     GetSpanCostForVehicleForDimension(route_nbr, kFakeDistance);
-
-            if (FLAGS_balance) {
-              total_time_balance_cost +=
-                  GetSpanCostForVehicleForDimension(route_nbr, kTimeBalance);
-              total_distance_balance_cost +=
-                  GetSpanCostForVehicleForDimension(route_nbr, kDistanceBalance);
-            }
-            total_time_without_wait_cost +=
-                GetSpanCostForVehicleForDimension(route_nbr, kTimeNoWait);
-            total_value_cost += GetSpanCostForVehicleForDimension(route_nbr, kValue);
-          }
+          nbr_routes += extractor_->ServiceCount(route_nbr) > 0;
+          nbr_services_served += extractor_->ServiceCount(route_nbr);
         }
+        const ortools_result::CostDetails& details = result_->cost_details();
+        costs_.Fill(nullptr, result_->mutable_cost_details());
 
+        RestoreVehiclePositions(data_, result_);
         result_->set_cost(best_result_ / CUSTOM_BIGNUM -
-                          (total_time_order_cost + total_distance_order_cost));
+                          (details.time_order() + details.distance_order()));
         result_->set_duration(1e-9 * (absl::GetCurrentTimeNanos() - start_time_));
         result_->set_iterations(iteration_counter_);
 
@@ -429,19 +705,17 @@ public:
           std::cout << "Cost breakdown:"
                     << "\n nbr_services_served: " << nbr_services_served
                     << "\n nbr_routes: " << nbr_routes
-                    << "\n total_vehicle_fixed_cost:     " << total_vehicle_fixed_cost
-                    << "\n total_time_cost:              " << total_time_cost
-                    << "\n total_distance_cost:          " << total_distance_cost
-                    << "\n total_time_balance_cost:      " << total_time_balance_cost
-                    << "\n total_distance_balance_cost:  " << total_distance_balance_cost
-                    << "\n total_fake_time_cost:         " << total_fake_time_cost
-                    << "\n total_fake_distance_cost:     " << total_fake_distance_cost
-                    << "\n total_time_without_wait_cost: " << total_time_without_wait_cost
-                    << "\n total_value_cost:             " << total_value_cost
+                    << "\n total_vehicle_fixed_cost:     " << details.fixed()
+                    << "\n total_time_cost:              " << details.time()
+                    << "\n total_distance_cost:          " << details.distance()
+                    << "\n total_time_balance_cost:      " << details.time_balance()
+                    << "\n total_distance_balance_cost:  " << details.distance_balance()
+                    << "\n total_time_without_wait_cost: " << details.time_without_wait()
+                    << "\n total_value_cost:             " << details.value()
                     << "\n Cost substracted from the results but used in optimization "
                        "(due to nearby flag):"
-                    << "\n total_time_order_cost:        " << total_time_order_cost
-                    << "\n total_distance_order_cost:    " << total_distance_order_cost
+                    << "\n total_time_order_cost:        " << details.time_order()
+                    << "\n total_distance_order_cost:    " << details.distance_order()
                     << std::endl;
         }
       }
@@ -494,7 +768,7 @@ public:
     start_time_        = copy_limit->start_time_;
     size_matrix_       = copy_limit->size_matrix_;
     result_            = copy_limit->result_;
-    stored_rests_      = copy_limit->stored_rests_;
+    extractor_         = copy_limit->extractor_;
 
     minimize_      = copy_limit->minimize_;
     limit_reached_ = copy_limit->limit_reached_;
@@ -505,7 +779,7 @@ public:
     // we don't to copy the variables
     return solver_->RevAlloc(
         new LoggerMonitor(data_, routing_, manager_, min_start_, size_matrix_, debug_,
-                          intermediate_, result_, stored_rests_, filename_, minimize_));
+                          intermediate_, result_, extractor_, filename_, minimize_));
   }
 
   virtual std::string DebugString() const {
@@ -542,7 +816,8 @@ private:
   std::unique_ptr<Assignment> prototype_;
   std::string filename_;
   ortools_result::Result* result_;
-  std::vector<std::vector<IntervalVar*>> stored_rests_;
+  RouteExtractor* extractor_;
+  CostBreakdown costs_;
 };
 
 } // namespace
@@ -551,11 +826,11 @@ LoggerMonitor* MakeLoggerMonitor(const TSPTWDataDT& data, RoutingModel* routing,
                                  RoutingIndexManager* manager, int64 min_start,
                                  int64 size_matrix, bool debug, bool intermediate,
                                  ortools_result::Result* result,
-                                 std::vector<std::vector<IntervalVar*>> stored_rests,
-                                 std::string filename, const bool minimize = true) {
+                                 RouteExtractor* extractor, std::string filename,
+                                 const bool minimize = true) {
   return routing->solver()->RevAlloc(
       new LoggerMonitor(data, routing, manager, min_start, size_matrix, debug,
-                        intermediate, result, stored_rests, filename, minimize));
+                        intermediate, result, extractor, filename, minimize));
 }
 } //  namespace operations_research
 
@@ -22,6 +22,10 @@
 #include <iostream>
 #include <sstream>
 #include <limits>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <memory>
 
 #include "ortools/base/random.h"
 #include "ortools/constraint_solver/routing.h"
@@ -48,7 +52,8 @@ struct Point {
 //  IsCreated(): the cost/distance matrix exists;
 //  IsInstanciated(): the matrix is filled.
 //
-//  Distances/costs can be symetric or not.
+//  Distances/costs can be symetric or not. Symmetric matrices are packed
+//  in lower triangular form once instanciated.
 class CompleteGraphArcCost {
 public:
   explicit CompleteGraphArcCost(int32 size = 0): size_(size), is_created_(false), is_instanciated_(false), is_symmetric_(false),
@@ -76,21 +81,28 @@ public:
     return is_instanciated_;
   }
 
-  void SetIsInstanciated(const bool instanciated = true) {
+  //  Costs greater than or equal to unreachable_cost are not taken into
+  //  account in MinCost() and MaxCost().
+  void SetIsInstanciated(const bool instanciated = true,
+                         const int64 unreachable_cost = kPostiveInfinityInt64) {
     CHECK(IsCreated()) << "Instance is not created!";
     is_instanciated_ = instanciated;
-    ComputeExtremeDistance();
-    ComputeIsSymmetric();
+    if (!is_instanciated_) {return;}
+    ComputeExtremeDistance(unreachable_cost);
+    if (!is_symmetric_ && ComputeIsSymmetric()) {
+      PackMatrix();
+    }
   }
 
   int64 Cost(RoutingIndexManager::NodeIndex from,
                    RoutingIndexManager::NodeIndex to) const {
-    return matrix_[MatrixIndex(from, to)];
+    return matrix_[is_symmetric_ ? TriangularIndex(from, to) : MatrixIndex(from, to)];
   }
 
+  //  Writing (from, to) also writes (to, from) on a symmetric matrix.
   int64& Cost(RoutingIndexManager::NodeIndex from,
                    RoutingIndexManager::NodeIndex to) {
-    return matrix_[MatrixIndex(from, to)];
+    return matrix_[is_symmetric_ ? TriangularIndex(from, to) : MatrixIndex(from, to)];
   }
 
   int64 MaxCost() const {
@@ -117,6 +129,25 @@ private:
     return (from * size_ + to).value();
   }
 
+  //  Row max(from, to) starts after the max(from, to) previous rows.
+  int64 TriangularIndex(RoutingIndexManager::NodeIndex from,
+                        RoutingIndexManager::NodeIndex to) const {
+    const int64 row = std::max(from.value(), to.value());
+    const int64 column = std::min(from.value(), to.value());
+    return row * (row + 1) / 2 + column;
+  }
+
+  void PackMatrix() {
+    std::unique_ptr<int64[]> packed(new int64 [static_cast<int64>(size_) * (size_ + 1) / 2]);
+    for (RoutingIndexManager::NodeIndex i(0); i < size_; ++i) {
+      for (RoutingIndexManager::NodeIndex j(0); j <= i; ++j) {
+        packed[TriangularIndex(i, j)] = matrix_[MatrixIndex(i, j)];
+      }
+    }
+    matrix_.swap(packed);
+    is_symmetric_ = true;
+  }
+
   void CreateMatrix(const int size) {
     CHECK_GT(size, 2) << "Size for matrix non consistent.";
     int64 * p_array = nullptr;
@@ -136,13 +167,13 @@ private:
     if (max_cost_ < dist) { max_cost_ = dist;}
   }
 
- void ComputeExtremeDistance() {
+ void ComputeExtremeDistance(const int64 unreachable_cost) {
     CHECK(IsInstanciated()) << "Instance is not instanciated!";
     min_cost_ = kPostiveInfinityInt64;
     max_cost_ = -1;
     for (RoutingIndexManager::NodeIndex i(0); i < size_; ++i) {
       for (RoutingIndexManager::NodeIndex j(0); j < size_; ++j) {
-        if (i == j) {continue;}
+        if (i == j || Cost(i,j) >= unreachable_cost) {continue;}
         UpdateExtremeDistance(Cost(i,j));
       }
     }
@@ -194,12 +225,111 @@ void CompleteGraphArcCost::Print(std::ostream& out, const bool label, const int
     }
     for (RoutingIndexManager::NodeIndex to(0); to < size_; ++to) {
       out.width(width);
-      out << std::right << matrix_[MatrixIndex(from, to)];
+      out << std::right << Cost(from, to);
     }
     out << std::endl;
   }
 }
 
+//  Container class to hold costs on the arcs from each node to its nearest
+//  neighbours only, for graphs too large for a CompleteGraphArcCost.
+//  Costs of the other arcs are estimated: coef times the great circle distance
+//  in meters when points are set (x latitude, y longitude), the sum of the
+//  costs to the farthest neighbours of both ends otherwise.
+class SparseGraphArcCost {
+public:
+  SparseGraphArcCost(int32 size, int32 neighbour_size): size_(size), neighbour_size_(neighbour_size),
+    neighbours_(static_cast<int64>(size) * neighbour_size, -1),
+    costs_(static_cast<int64>(size) * neighbour_size, 0), farthest_costs_(size, 0),
+    estimation_coef_(0), is_instanciated_(false), max_cost_(-1) {}
+
+  int32 Size() const {
+    return size_;
+  }
+
+  int32 NeighbourSize() const {
+    return neighbour_size_;
+  }
+
+  void SetNeighbour(RoutingIndexManager::NodeIndex from, const int32 rank,
+                    RoutingIndexManager::NodeIndex to, const int64 cost) {
+    CHECK_LT(rank, neighbour_size_) << "Neighbour rank out of range!";
+    neighbours_[from.value() * static_cast<int64>(neighbour_size_) + rank] = to.value();
+    costs_[from.value() * static_cast<int64>(neighbour_size_) + rank] = cost;
+  }
+
+  //  -1 for an unused rank.
+  int32 Neighbour(RoutingIndexManager::NodeIndex from, const int32 rank) const {
+    return neighbours_[from.value() * static_cast<int64>(neighbour_size_) + rank];
+  }
+
+  void SetPoints(const std::vector<Point>& points, const double estimation_coef) {
+    CHECK_EQ(static_cast<int32>(points.size()), size_) << "One point per node expected!";
+    points_ = points;
+    estimation_coef_ = estimation_coef;
+  }
+
+  //  Costs greater than or equal to unreachable_cost are not taken into
+  //  account in MaxCost() and in the estimations.
+  void SetIsInstanciated(const int64 unreachable_cost = kPostiveInfinityInt64) {
+    max_cost_ = -1;
+    for (int32 i = 0; i < size_; ++i) {
+      farthest_costs_[i] = 0;
+      for (int64 n = i * static_cast<int64>(neighbour_size_); n < (i + 1) * static_cast<int64>(neighbour_size_); ++n) {
+        if (neighbours_[n] == -1 || costs_[n] >= unreachable_cost) {continue;}
+        farthest_costs_[i] = std::max(farthest_costs_[i], costs_[n]);
+      }
+      max_cost_ = std::max(max_cost_, farthest_costs_[i]);
+    }
+    is_instanciated_ = true;
+  }
+
+  int64 Cost(RoutingIndexManager::NodeIndex from,
+             RoutingIndexManager::NodeIndex to) const {
+    if (from == to) {return 0;}
+    const int64 first = from.value() * static_cast<int64>(neighbour_size_);
+    for (int64 n = first; n < first + neighbour_size_; ++n) {
+      if (neighbours_[n] == to.value()) {return costs_[n];}
+    }
+    return EstimatedCost(from, to);
+  }
+
+  int64 MaxCost() const {
+    CHECK(is_instanciated_) << "Instance is not instanciated!";
+    return max_cost_;
+  }
+
+private:
+  int64 EstimatedCost(RoutingIndexManager::NodeIndex from,
+                      RoutingIndexManager::NodeIndex to) const {
+    if (points_.empty()) {
+      return farthest_costs_[from.value()] + farthest_costs_[to.value()];
+    }
+    return static_cast<int64>(
+        estimation_coef_ * GreatCircleDistance(points_[from.value()], points_[to.value()]) + 0.5);
+  }
+
+  static double GreatCircleDistance(const Point& a, const Point& b) {
+    const double kEarthRadius = 6371000.0;
+    const double kRadians = M_PI / 180.0;
+    const double sin_latitude = std::sin((b.x - a.x) * kRadians / 2);
+    const double sin_longitude = std::sin((b.y - a.y) * kRadians / 2);
+    const double h = sin_latitude * sin_latitude +
+        std::cos(a.x * kRadians) * std::cos(b.x * kRadians) * sin_longitude * sin_longitude;
+    return 2 * kEarthRadius * std::asin(std::min(1.0, std::sqrt(h)));
+  }
+
+  int32 size_;
+  int32 neighbour_size_;
+  std::vector<int32> neighbours_;
+  std::vector<int64> costs_;
+  std::vector<int64> farthest_costs_;
+  std::vector<Point> points_;
+  double estimation_coef_;
+  bool is_instanciated_;
+  int64 max_cost_;
+};
+
 struct BoundingBox {
 
   BoundingBox(): min_x(std::numeric_limits<double>::max()),
@@ -0,0 +1,201 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_SCHEDULER_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_SCHEDULER_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "./tsptw_data_dt.h"
+
+#include "ortools/constraint_solver/routing.h"
+
+namespace operations_research {
+
+//  Schedules fixed routes once the search is over, in linear time in the route
+//  length. Routes are given as routing indices from the vehicle start to its end.
+//  A disabled scheduler leaves every value to the solver finalizers.
+class RouteScheduler {
+public:
+  RouteScheduler(const TSPTWDataDT& data, const RoutingIndexManager& manager,
+                 bool enabled)
+      : data_(data)
+      , manager_(manager)
+      , enabled_(enabled)
+      , unit_size_(data.Quantities(RoutingIndexManager::NodeIndex(0)).size())
+      , time_linked_nodes_(data.SizeMissions(), false)
+      , time_linked_vehicles_(data.Vehicles().size(), false) {
+    for (const TSPTWDataDT::Relation* relation : data.Relations()) {
+      if (relation->type == MeetUp || relation->type == MaximumDurationLapse) {
+        for (const std::string& linked_id : *relation->linked_ids)
+          time_linked_nodes_[data.IdIndex(linked_id)] = true;
+      } else if (relation->type == VehicleTrips ||
+                 relation->type == VehicleGroupDuration) {
+        for (const std::string& vehicle_id : *relation->linked_vehicle_ids) {
+          const int64 vehicle = data.VehicleIdIndex(vehicle_id);
+          if (vehicle >= 0)
+            time_linked_vehicles_[vehicle] = true;
+        }
+      }
+    }
+    for (int i = 0; i < data.SizeMissions(); ++i) {
+      if (data.LateMultiplier(RoutingIndexManager::NodeIndex(i)) > 0)
+        time_linked_nodes_[i] = true;
+    }
+  }
+
+  //  Whether the times of the vehicle are computed here rather than by
+  //  finalizer variables. Time costs are left to the search, the schedule
+  //  having the least span of the route.
+  bool SchedulesTimes(int vehicle) const {
+    if (!enabled_ || time_linked_vehicles_[vehicle])
+      return false;
+    const TSPTWDataDT::Vehicle* data_vehicle = data_.Vehicles().at(vehicle);
+    return data_vehicle->late_multiplier == 0 && data_vehicle->duration < 0 &&
+           !data_vehicle->free_approach && !data_vehicle->free_return;
+  }
+
+  bool Enabled() const { return enabled_; }
+
+  //  Start times along the route following the vehicle shift preference, around
+  //  the rests found by the search. Empty when the solver values have to be
+  //  kept.
+  std::vector<int64> StartTimes(int vehicle, const std::vector<int64>& route,
+                                const std::vector<std::pair<int64, int64>>& rests) const {
+    std::vector<int64> times;
+    if (!SchedulesTimes(vehicle))
+      return times;
+    for (const int64 index : route) {
+      const int node = manager_.IndexToNode(index).value();
+      if (node < data_.SizeMissions() && time_linked_nodes_[node])
+        return times;
+    }
+    return Schedule(vehicle, route, rests);
+  }
+
+  //  Start times of a route respecting its time windows, following the vehicle
+  //  shift preference. Rests are fixed intervals, start and duration by start
+  //  time, each one taken on the way to the first service it would overlap.
+  std::vector<int64>
+  Schedule(int vehicle, const std::vector<int64>& route,
+           const std::vector<std::pair<int64, int64>>& rests = {}) const {
+    const TSPTWDataDT::Vehicle* data_vehicle = data_.Vehicles().at(vehicle);
+    std::vector<int64> transits;
+    for (std::size_t position = 0; position + 1 < route.size(); ++position)
+      transits.push_back(data_vehicle->TimePlusServiceTime(
+          manager_.IndexToNode(route[position]), manager_.IndexToNode(route[position + 1])));
+
+    // Earliest schedule, the rests before each position ending before it starts
+    std::vector<int64> times(route.size());
+    std::vector<std::size_t> rest_ends(route.size(), 0);
+    times[0]         = std::max<int64>(data_vehicle->time_start, 0);
+    std::size_t rest = 0;
+    for (std::size_t position = 1; position < route.size(); ++position) {
+      int64 arrival = times[position - 1] + transits[position - 1];
+      int64 start   = Earliest(route[position], arrival);
+      while (rest < rests.size() &&
+             (position + 1 == route.size() ||
+              rests[rest].first < start + ServiceTime(route[position]))) {
+        arrival = std::max(arrival, rests[rest].first) + rests[rest].second;
+        start   = Earliest(route[position], arrival);
+        ++rest;
+      }
+      times[position]     = start;
+      rest_ends[position] = rest;
+    }
+    if (data_vehicle->shift_preference == ForceStart)
+      return times;
+
+    // Latest schedule ending at the vehicle closing or at the earliest end, the
+    // service before rests ending before the first one starts
+    if (data_vehicle->shift_preference == ForceEnd && data_vehicle->time_end < CUSTOM_MAX_INT)
+      times.back() = std::max(times.back(), data_vehicle->time_end);
+    for (std::size_t position = route.size() - 1; position-- > 0;) {
+      int64 departure = times[position + 1] - transits[position];
+      for (std::size_t r = rest_ends[position]; r < rest_ends[position + 1]; ++r)
+        departure -= rests[r].second;
+      if (rest_ends[position] < rest_ends[position + 1])
+        departure = std::min(departure, rests[rest_ends[position]].first -
+                                            ServiceTime(route[position]));
+      times[position] = Latest(route[position], departure);
+    }
+    return times;
+  }
+
+  //  Minimal quantity cumuls of each unit along the route. Starts and refill
+  //  services may raise the quantity, other services only add their own.
+  std::vector<std::vector<int64>> Quantities(const std::vector<int64>& route) const {
+    std::vector<std::vector<int64>> quantities(unit_size_,
+                                               std::vector<int64>(route.size(), 0));
+    for (std::size_t unit = 0; unit < unit_size_; ++unit) {
+      std::vector<int64> transits;
+      std::vector<bool> refills;
+      for (std::size_t position = 0; position + 1 < route.size(); ++position) {
+        const RoutingIndexManager::NodeIndex node = manager_.IndexToNode(route[position]);
+        transits.push_back(
+            data_.Quantity(unit, node, manager_.IndexToNode(route[position + 1])));
+        refills.push_back(position == 0 || (node.value() < data_.SizeMissions() &&
+                                            data_.RefillQuantities(node).at(unit)));
+      }
+
+      // Quantity needed at each position to keep the following ones positive
+      std::vector<int64> needs(route.size(), 0);
+      for (std::size_t position = route.size() - 1; position-- > 0;)
+        needs[position] =
+            refills[position]
+                ? 0
+                : std::max<int64>(0, needs[position + 1] - transits[position]);
+
+      std::vector<int64>& cumuls = quantities[unit];
+      cumuls[0]                  = needs[0];
+      for (std::size_t position = 1; position < route.size(); ++position) {
+        cumuls[position] = cumuls[position - 1] + transits[position - 1];
+        if (refills[position - 1])
+          cumuls[position] = std::max(cumuls[position], needs[position]);
+      }
+    }
+    return quantities;
+  }
+
+private:
+  int64 ServiceTime(int64 index) const {
+    return data_.ServiceTime(manager_.IndexToNode(index));
+  }
+
+  //  Earliest start within the time windows, from the arrival time
+  int64 Earliest(int64 index, int64 time) const {
+    const RoutingIndexManager::NodeIndex node = manager_.IndexToNode(index);
+    if (node.value() >= data_.SizeMissions())
+      return time;
+    const std::vector<int64> ready = data_.ReadyTime(node);
+    const std::vector<int64> due   = data_.DueTime(node);
+    for (std::size_t tw = 0; tw < ready.size(); ++tw) {
+      if (due[tw] >= time)
+        return std::max(time, ready[tw]);
+    }
+    return time;
+  }
+
+  //  Latest start within the time windows, before the departure time
+  int64 Latest(int64 index, int64 time) const {
+    const RoutingIndexManager::NodeIndex node = manager_.IndexToNode(index);
+    if (node.value() >= data_.SizeMissions())
+      return time;
+    const std::vector<int64> ready = data_.ReadyTime(node);
+    const std::vector<int64> due   = data_.DueTime(node);
+    for (std::size_t tw = ready.size(); tw-- > 0;) {
+      if (ready[tw] <= time)
+        return std::min(time, due[tw]);
+    }
+    return time;
+  }
+
+  const TSPTWDataDT& data_;
+  const RoutingIndexManager& manager_;
+  const bool enabled_;
+  const std::size_t unit_size_;
+  std::vector<bool> time_linked_nodes_;
+  std::vector<bool> time_linked_vehicles_;
+};
+} //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_SCHEDULER_H
@@ -0,0 +1,843 @@
+#ifndef OR_TOOLS_TUTORIALS_CPLUSPLUS_SINGLE_VEHICLE_H
+#define OR_TOOLS_TUTORIALS_CPLUSPLUS_SINGLE_VEHICLE_H
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./limits.h"
+#include "./ortools_result.pb.h"
+#include "./scheduler.h"
+#include "./tsptw_data_dt.h"
+
+#include "ortools/constraint_solver/routing_index_manager.h"
+
+DEFINE_int64(single_vehicle_size, 500,
+             "Number of services up to which single vehicle problems are solved by a "
+             "dedicated local search, 0 to disable");
+DEFINE_int64(single_vehicle_perturbations, 100,
+             "Perturbations without improvement after which the single vehicle local "
+             "search stops before the time limit, 0 to stop at the first local optimum");
+
+namespace operations_research {
+
+//  Local search on the route of a single vehicle, without the routing model.
+//  The route is a flat array of items: services, rests, and the vehicle start
+//  and end. A first route is built by insertion, then improved by insertion,
+//  relocate, Or-opt, 2-opt and removal moves until a local optimum. Local optima
+//  are escaped by removing a random chain of services and inserting them back
+//  in a random order before descending again, the best route being kept, until
+//  the time limit or too many perturbations without improvement. A move is
+//  described by the pieces of the current route it chains.
+//
+//  With hard single time windows and no rest, every prefix and suffix of the
+//  route keeps its slack segment (minimal duration, departure range, sums and
+//  load range), recomputed from the changed positions only once a move is
+//  applied. A move chains them with the segments of the moved items, the inner
+//  pieces being extended one item at a time along the move loops, so it is
+//  evaluated in amortized constant time. Otherwise moves are evaluated by a
+//  pass over the candidate route. Transits are precomputed between every pair
+//  of items.
+class SingleVehicleSolver {
+public:
+  SingleVehicleSolver(const TSPTWDataDT& data, const RoutingIndexManager& manager,
+                      int64 horizon, std::vector<int64> penalties, int64 time_limit_in_ms)
+      : data_(data)
+      , manager_(manager)
+      , vehicle_(data.Vehicles().at(0))
+      , horizon_(horizon)
+      , penalties_(std::move(penalties))
+      , time_limit_in_ms_(time_limit_in_ms)
+      , start_time_(absl::GetCurrentTimeNanos())
+      , size_(data.SizeMissions())
+      , scheduler_(data, manager, true)
+      , middle_begin_(-1)
+      , middle_end_(-1)
+      , middle_reversed_(false)
+      , route_cost_(kint64max)
+      , iterations_(0)
+      , generator_(0) {}
+
+  bool Applicable() const {
+    if (size_ == 0 || size_ > FLAGS_single_vehicle_size || data_.Vehicles().size() != 1 ||
+        !data_.Relations().empty() || FLAGS_balance || FLAGS_nearby)
+      return false;
+    if (vehicle_->free_approach || vehicle_->free_return ||
+        vehicle_->shift_preference == ForceEnd)
+      return false;
+    for (std::size_t unit = 0; unit < vehicle_->capacity.size(); ++unit) {
+      if (vehicle_->capacity[unit] >= 0 && vehicle_->overload_multiplier[unit] > 0)
+        return false;
+    }
+    for (const TSPTWDataDT::Rest& rest : vehicle_->rests) {
+      if (rest.ready_time.empty() || rest.due_time.empty())
+        return false;
+    }
+    for (int32 activity = 0; activity <= data_.SizeProblem(); ++activity) {
+      if (data_.AlternativeSize(activity) > 1)
+        return false;
+    }
+    for (int i = 0; i < size_; ++i) {
+      for (const bool refill : data_.RefillQuantities(RoutingIndexManager::NodeIndex(i))) {
+        if (refill)
+          return false;
+      }
+    }
+    return true;
+  }
+
+  //  Fills the route, the cost and its details. False when the engine found no
+  //  route serving the mandatory services.
+  bool Solve(ortools_result::Result* result) {
+    Precompute();
+    route_.clear();
+    route_.push_back(size_);
+    std::vector<int> rests(vehicle_->rests.size());
+    for (std::size_t rest = 0; rest < rests.size(); ++rest)
+      rests[rest] = size_ + 2 + rest;
+    std::sort(rests.begin(), rests.end(), [this](int a, int b) {
+      return rest_readies_[a - size_ - 2] < rest_readies_[b - size_ - 2];
+    });
+    route_.insert(route_.end(), rests.begin(), rests.end());
+    route_.push_back(size_ + 1);
+    served_.assign(size_, false);
+    Apply({Piece(0, route_.size() - 1)});
+    if (route_cost_ == kint64max)
+      return false;
+
+    // Services by opening, each one inserted at its best position
+    std::vector<int> services;
+    for (int i = 0; i < size_; ++i) {
+      if (allowed_[i])
+        services.push_back(i);
+    }
+    std::stable_sort(services.begin(), services.end(), [this](int a, int b) {
+      return readies_[window_starts_[a]] < readies_[window_starts_[b]];
+    });
+    for (const int service : services)
+      InsertService(service);
+    Descend();
+
+    std::vector<int> best_route = route_;
+    int64 best_cost             = TotalCost();
+    int64 failures              = 0;
+    while (failures < FLAGS_single_vehicle_perturbations && !TimeOut()) {
+      if (Perturb())
+        Descend();
+      const int64 cost = TotalCost();
+      if (cost < best_cost) {
+        best_cost  = cost;
+        best_route = route_;
+        failures   = 0;
+      } else {
+        SetRoute(best_route);
+        ++failures;
+      }
+    }
+
+    for (int i = 0; i < size_; ++i) {
+      if (!served_[i] && penalties_[i] == kint64max)
+        return false;
+    }
+    FillResult(result);
+    return true;
+  }
+
+  int64 Iterations() const { return iterations_; }
+
+private:
+  //  Route positions from begin to end, or a single item out of the route
+  struct Piece {
+    Piece(int b, int e, bool r = false)
+        : begin(b)
+        , end(e)
+        , reversed(r)
+        , item(-1) {}
+    explicit Piece(int i)
+        : begin(-1)
+        , end(-1)
+        , reversed(false)
+        , item(i) {}
+    int begin;
+    int end;
+    bool reversed;
+    int item;
+  };
+
+  //  Chained items. Departing from the first one within [earliest, latest]
+  //  reaches the last one after the minimal duration, loads of the limited
+  //  units range from low to high relative to the first item.
+  struct Segment {
+    int first;
+    int last;
+    int services;
+    bool feasible;
+    int64 duration;
+    int64 earliest;
+    int64 latest;
+    int64 transit;
+    int64 distance;
+    int64 value;
+    std::vector<int64> sums;
+    std::vector<int64> lows;
+    std::vector<int64> highs;
+  };
+
+  //  Schedule of a route: costs and start times of its items
+  struct Pass {
+    bool feasible;
+    int64 span;
+    int64 shift;
+    int64 transit;
+    int64 distance;
+    int64 value;
+    int64 lateness;
+    int services;
+  };
+
+  bool TimeOut() const {
+    return time_limit_in_ms_ > 0 &&
+           1e-6 * (absl::GetCurrentTimeNanos() - start_time_) > time_limit_in_ms_;
+  }
+
+  bool IsRest(int item) const { return item >= size_ + 2; }
+
+  RoutingIndexManager::NodeIndex Node(int item) const {
+    if (item == size_)
+      return vehicle_->start;
+    if (item == size_ + 1)
+      return vehicle_->stop;
+    return RoutingIndexManager::NodeIndex(item);
+  }
+
+  int64 Arc(const std::vector<int64>& matrix, int from, int to) const {
+    return matrix[from * (size_ + 2) + to];
+  }
+
+  void Precompute() {
+    const int nodes = size_ + 2;
+    transits_.resize(nodes * nodes);
+    distances_.resize(nodes * nodes);
+    values_.resize(nodes * nodes);
+    for (std::size_t unit = 0; unit < vehicle_->capacity.size(); ++unit) {
+      if (vehicle_->capacity[unit] >= 0) {
+        units_.push_back(unit);
+        capacities_.push_back(vehicle_->capacity[unit]);
+      }
+    }
+    quantities_.assign(units_.size(), std::vector<int64>(nodes * nodes, 0));
+    for (int from = 0; from < nodes; ++from) {
+      for (int to = 0; to < nodes; ++to) {
+        const int arc = from * nodes + to;
+        transits_[arc]  = vehicle_->TimePlusServiceTime(Node(from), Node(to));
+        distances_[arc] = vehicle_->Distance(Node(from), Node(to));
+        values_[arc]    = vehicle_->ValuePlusServiceValue(Node(from), Node(to));
+        for (std::size_t unit = 0; unit < units_.size(); ++unit)
+          quantities_[unit][arc] = data_.Quantity(units_[unit], Node(from), Node(to));
+      }
+    }
+
+    segment_mode_ = vehicle_->rests.empty() && vehicle_->late_multiplier == 0;
+    window_starts_.assign(1, 0);
+    for (int i = 0; i < size_; ++i) {
+      const RoutingIndexManager::NodeIndex node(i);
+      const std::vector<int64> ready = data_.ReadyTime(node);
+      const std::vector<int64> due   = data_.DueTime(node);
+      if (ready.empty()) {
+        readies_.push_back(0);
+        dues_.push_back(horizon_);
+      }
+      for (std::size_t tw = 0; tw < ready.size(); ++tw) {
+        readies_.push_back(std::max<int64>(ready[tw], 0));
+        dues_.push_back(due[tw] < CUSTOM_MAX_INT ? std::min(due[tw], horizon_) : horizon_);
+      }
+      window_starts_.push_back(readies_.size());
+      late_multipliers_.push_back(data_.LateMultiplier(node));
+      segment_mode_ = segment_mode_ && ready.size() <= 1 && late_multipliers_.back() == 0;
+
+      const std::vector<int64> vehicle_indices = data_.VehicleIndices(node);
+      allowed_.push_back(vehicle_indices.empty() ||
+                         std::find(vehicle_indices.begin(), vehicle_indices.end(), 0) !=
+                             vehicle_indices.end());
+    }
+
+    for (const TSPTWDataDT::Rest& rest : vehicle_->rests) {
+      rest_readies_.push_back(std::max(rest.ready_time[0], vehicle_->time_start));
+      rest_dues_.push_back(
+          std::min(rest.due_time[0], vehicle_->time_end - rest.service_time));
+      rest_durations_.push_back(rest.service_time);
+      rest_ids_.push_back(rest.rest_id);
+    }
+
+    departure_ = std::max<int64>(vehicle_->time_start, 0);
+    end_due_   = vehicle_->time_end < CUSTOM_MAX_INT && vehicle_->late_multiplier == 0
+                   ? std::min(vehicle_->time_end, horizon_)
+                   : horizon_;
+    distance_limit_ = vehicle_->distance > 0 ? vehicle_->distance : kint64max;
+    duration_limit_ = vehicle_->duration >= 0 &&
+                              vehicle_->time_end - vehicle_->time_start > vehicle_->duration
+                          ? vehicle_->duration
+                          : kint64max;
+
+    if (segment_mode_) {
+      for (int item = 0; item < nodes; ++item)
+        singles_.push_back(Single(item));
+    }
+  }
+
+  Segment Single(int item) const {
+    Segment segment;
+    segment.first    = item;
+    segment.last     = item;
+    segment.services = item < size_;
+    segment.feasible = true;
+    segment.duration = 0;
+    segment.transit  = 0;
+    segment.distance = 0;
+    segment.value    = 0;
+    segment.sums.assign(units_.size(), 0);
+    segment.lows.assign(units_.size(), 0);
+    segment.highs.assign(units_.size(), 0);
+    if (item == size_) {
+      segment.earliest = departure_;
+      segment.latest   = vehicle_->shift_preference == ForceStart ? departure_ : horizon_;
+    } else if (item == size_ + 1) {
+      segment.earliest = 0;
+      segment.latest   = end_due_;
+    } else {
+      segment.earliest = readies_[window_starts_[item]];
+      segment.latest   = dues_[window_starts_[item]];
+    }
+    return segment;
+  }
+
+  //  Chains a then b into segment, which may be one of them so that segments
+  //  are extended in place without reallocating their loads
+  void Concat(const Segment& a, const Segment& b, Segment* segment) const {
+    const int64 transit  = Arc(transits_, a.last, b.first);
+    const int64 delta    = a.duration + transit;
+    const int64 waiting  = std::max<int64>(b.earliest - delta - a.latest, 0);
+    const int64 distance = a.distance + Arc(distances_, a.last, b.first) + b.distance;
+    const int64 value    = a.value + Arc(values_, a.last, b.first) + b.value;
+    bool feasible        = a.feasible && b.feasible && a.earliest + delta <= b.latest;
+    const int first      = a.first;
+    segment->services    = a.services + b.services;
+    segment->duration    = a.duration + b.duration + transit + waiting;
+    segment->earliest    = std::max(b.earliest - delta, a.earliest) - waiting;
+    segment->latest      = std::min(b.latest - delta, a.latest);
+    segment->transit     = a.transit + transit + b.transit;
+    segment->distance    = distance;
+    segment->value       = value;
+    segment->sums.resize(units_.size());
+    segment->lows.resize(units_.size());
+    segment->highs.resize(units_.size());
+    for (std::size_t unit = 0; unit < units_.size(); ++unit) {
+      const int64 load = a.sums[unit] + Arc(quantities_[unit], a.last, b.first);
+      const int64 low  = std::min(a.lows[unit], load + b.lows[unit]);
+      const int64 high = std::max(a.highs[unit], load + b.highs[unit]);
+      segment->sums[unit]  = load + b.sums[unit];
+      segment->lows[unit]  = low;
+      segment->highs[unit] = high;
+      feasible             = feasible && high - low <= capacities_[unit];
+    }
+    segment->first    = first;
+    segment->last     = b.last;
+    segment->feasible = feasible;
+  }
+
+  //  Updates the prefix and suffix segments of the route replacing previous,
+  //  keeping the prefixes before its first change and the suffixes after its
+  //  last one
+  void BuildSegments(const std::vector<int>& previous) {
+    const int size     = route_.size();
+    const int old_size = previous.size();
+    int first          = 0;
+    while (first < std::min(size, old_size) && route_[first] == previous[first])
+      ++first;
+    int tail = 0;
+    while (tail < std::min(size, old_size) - first &&
+           route_[size - 1 - tail] == previous[old_size - 1 - tail])
+      ++tail;
+
+    prefixes_.resize(size);
+    if (size > old_size)
+      suffixes_.insert(suffixes_.begin(), size - old_size, Segment());
+    else
+      suffixes_.erase(suffixes_.begin(), suffixes_.begin() + old_size - size);
+    for (int position = first; position < size; ++position) {
+      if (position == 0)
+        prefixes_[position] = singles_[route_[position]];
+      else
+        Concat(prefixes_[position - 1], singles_[route_[position]], &prefixes_[position]);
+    }
+    for (int position = size - 1 - tail; position >= 0; --position) {
+      if (position == size - 1)
+        suffixes_[position] = singles_[route_[position]];
+      else
+        Concat(singles_[route_[position]], suffixes_[position + 1], &suffixes_[position]);
+    }
+    middle_begin_ = -1;
+  }
+
+  int64 Cost(int64 span, int64 transit, int64 distance, int64 value, int64 lateness,
+             int services) const {
+    return (services > 0 ? vehicle_->cost_fixed : 0) +
+           vehicle_->cost_waiting_time_multiplier * span +
+           std::max<int64>(vehicle_->cost_time_multiplier -
+                               vehicle_->cost_waiting_time_multiplier,
+                           0) *
+               transit +
+           vehicle_->cost_distance_multiplier * distance +
+           vehicle_->cost_value_multiplier * value + lateness;
+  }
+
+  //  Route cost of the chained pieces, kint64max when infeasible
+  int64 Evaluate(const std::vector<Piece>& pieces) {
+    if (segment_mode_) {
+      Segment& route = route_segment_;
+      route          = PieceSegment(pieces[0]);
+      for (std::size_t piece = 1; piece < pieces.size(); ++piece)
+        Concat(route, PieceSegment(pieces[piece]), &route);
+      if (!route.feasible || route.distance > distance_limit_ ||
+          route.duration > duration_limit_)
+        return kint64max;
+      return Cost(route.duration, route.transit, route.distance, route.value, 0,
+                  route.services);
+    }
+    Flatten(pieces, &items_);
+    Pass pass;
+    if (!Run(items_, departure_, nullptr, &pass))
+      return kint64max;
+    return Cost(pass.span, pass.transit, pass.distance, pass.value, pass.lateness,
+                pass.services);
+  }
+
+  //  Segment of the piece, valid until the next call
+  const Segment& PieceSegment(const Piece& piece) {
+    if (piece.item >= 0)
+      return singles_[piece.item];
+    if (!piece.reversed && piece.begin == 0)
+      return prefixes_[piece.end];
+    if (!piece.reversed && piece.end + 1 == static_cast<int>(route_.size()))
+      return suffixes_[piece.begin];
+    if (piece.end - piece.begin < 3) {
+      Chain(piece.begin, piece.end, piece.reversed, &chain_);
+      return chain_;
+    }
+
+    // Longer inner pieces grow by one item from one call to the next
+    if (piece.reversed == middle_reversed_ && piece.begin == middle_begin_ &&
+        piece.end == middle_end_ + 1) {
+      const Segment& single = singles_[route_[piece.end]];
+      if (piece.reversed)
+        Concat(single, middle_, &middle_);
+      else
+        Concat(middle_, single, &middle_);
+    } else if (piece.reversed == middle_reversed_ && piece.begin + 1 == middle_begin_ &&
+               piece.end == middle_end_) {
+      const Segment& single = singles_[route_[piece.begin]];
+      if (piece.reversed)
+        Concat(middle_, single, &middle_);
+      else
+        Concat(single, middle_, &middle_);
+    } else if (piece.reversed != middle_reversed_ || piece.begin != middle_begin_ ||
+               piece.end != middle_end_) {
+      Chain(piece.begin, piece.end, piece.reversed, &middle_);
+    }
+    middle_begin_    = piece.begin;
+    middle_end_      = piece.end;
+    middle_reversed_ = piece.reversed;
+    return middle_;
+  }
+
+  void Chain(int begin, int end, bool reversed, Segment* segment) const {
+    *segment = singles_[route_[begin]];
+    for (int position = begin + 1; position <= end; ++position) {
+      if (reversed)
+        Concat(singles_[route_[position]], *segment, segment);
+      else
+        Concat(*segment, singles_[route_[position]], segment);
+    }
+  }
+
+  void Flatten(const std::vector<Piece>& pieces, std::vector<int>* items) const {
+    items->clear();
+    for (const Piece& piece : pieces) {
+      if (piece.item >= 0) {
+        items->push_back(piece.item);
+      } else if (piece.reversed) {
+        for (int position = piece.end; position >= piece.begin; --position)
+          items->push_back(route_[position]);
+      } else {
+        for (int position = piece.begin; position <= piece.end; ++position)
+          items->push_back(route_[position]);
+      }
+    }
+  }
+
+  //  Schedules the items from the departure. Rests are taken on the arrival at
+  //  the next service, possibly while waiting for its opening. Without forced
+  //  start, the departure is delayed by the waiting time the route allows,
+  //  which is its shift.
+  bool Run(const std::vector<int>& items, int64 departure, std::vector<int64>* times,
+           Pass* pass) const {
+    pass->transit  = 0;
+    pass->distance = 0;
+    pass->value    = 0;
+    pass->lateness = 0;
+    pass->services = 0;
+    if (times != nullptr)
+      times->assign(items.size(), departure);
+    std::vector<int64> loads(units_.size(), 0), lows(loads), highs(loads);
+    int64 time     = departure;
+    int64 waiting  = 0;
+    int64 slack    = kint64max;
+    int previous   = items[0];
+    int first_rest = -1;
+    for (std::size_t position = 1; position < items.size(); ++position) {
+      const int item = items[position];
+      if (IsRest(item)) {
+        if (first_rest < 0)
+          first_rest = position;
+        continue;
+      }
+      int64 arrival = time + Arc(transits_, previous, item);
+      pass->transit += Arc(transits_, previous, item);
+      pass->distance += Arc(distances_, previous, item);
+      pass->value += Arc(values_, previous, item);
+      for (std::size_t unit = 0; unit < units_.size(); ++unit) {
+        loads[unit] += Arc(quantities_[unit], previous, item);
+        lows[unit]  = std::min(lows[unit], loads[unit]);
+        highs[unit] = std::max(highs[unit], loads[unit]);
+        if (highs[unit] - lows[unit] > capacities_[unit])
+          return false;
+      }
+
+      // Rests since the previous service
+      for (int r = first_rest; r >= 0 && r < static_cast<int>(position); ++r) {
+        const int rest         = items[r] - size_ - 2;
+        const int64 rest_start = std::max(arrival, rest_readies_[rest]);
+        if (rest_start > rest_dues_[rest])
+          return false;
+        waiting += rest_start - arrival;
+        slack   = std::min(slack, waiting + rest_dues_[rest] - rest_start);
+        arrival = rest_start + rest_durations_[rest];
+        if (times != nullptr)
+          (*times)[r] = rest_start;
+      }
+      first_rest = -1;
+
+      int64 start = arrival;
+      if (item == size_ + 1) {
+        if (vehicle_->time_end < CUSTOM_MAX_INT && vehicle_->late_multiplier > 0) {
+          pass->lateness +=
+              vehicle_->late_multiplier * std::max<int64>(arrival - vehicle_->time_end, 0);
+          slack = std::min(slack,
+                           waiting + std::max<int64>(vehicle_->time_end - arrival, 0));
+        } else if (arrival > end_due_) {
+          return false;
+        } else {
+          slack = std::min(slack, waiting + end_due_ - arrival);
+        }
+      } else {
+        ++pass->services;
+        int tw = window_starts_[item];
+        while (tw < window_starts_[item + 1] && dues_[tw] < arrival)
+          ++tw;
+        if (tw < window_starts_[item + 1]) {
+          start = std::max(arrival, readies_[tw]);
+          waiting += start - arrival;
+          slack = std::min(slack, waiting + dues_[tw] - start);
+        } else if (late_multipliers_[item] > 0 && arrival <= horizon_) {
+          pass->lateness += late_multipliers_[item] * (arrival - dues_[tw - 1]);
+          slack = std::min(slack, waiting);
+        } else {
+          return false;
+        }
+      }
+      if (times != nullptr)
+        (*times)[position] = start;
+      time     = start;
+      previous = item;
+    }
+
+    pass->shift = vehicle_->shift_preference == ForceStart
+                      ? 0
+                      : std::max<int64>(std::min(waiting, slack), 0);
+    pass->span     = time - departure - pass->shift;
+    pass->feasible = pass->distance <= distance_limit_ && pass->span <= duration_limit_;
+    return pass->feasible;
+  }
+
+  //  Replaces the route by the chained pieces
+  void Apply(const std::vector<Piece>& pieces) {
+    std::vector<int> route;
+    Flatten(pieces, &route);
+    SetRoute(route);
+  }
+
+  void SetRoute(std::vector<int> route) {
+    route_.swap(route);
+    if (segment_mode_)
+      BuildSegments(route);
+    route_cost_ = Evaluate({Piece(0, route_.size() - 1)});
+    std::fill(served_.begin(), served_.end(), false);
+    for (const int item : route_) {
+      if (item < size_)
+        served_[item] = true;
+    }
+  }
+
+  void InsertService(int service) {
+    const int last  = route_.size() - 1;
+    int64 best_cost = kint64max;
+    int best_after  = -1;
+    for (int after = 0; after < last; ++after) {
+      const int64 cost =
+          Evaluate({Piece(0, after), Piece(service), Piece(after + 1, last)});
+      if (cost < best_cost) {
+        best_cost  = cost;
+        best_after = after;
+      }
+    }
+    if (best_after >= 0 && (penalties_[service] == kint64max ||
+                            best_cost - route_cost_ < penalties_[service]))
+      Apply({Piece(0, best_after), Piece(service), Piece(best_after + 1, last)});
+  }
+
+  //  Route cost plus the exclusion costs of the unperformed services
+  int64 TotalCost() const {
+    int64 cost = route_cost_;
+    for (int i = 0; i < size_; ++i) {
+      if (!served_[i])
+        cost = cost > kint64max - penalties_[i] ? kint64max : cost + penalties_[i];
+    }
+    return cost;
+  }
+
+  void Descend() {
+    while (!TimeOut() && Improve())
+      ++iterations_;
+  }
+
+  //  Removes a random chain of services, the rests among them staying in place,
+  //  and inserts the services back in a random order. False when the route
+  //  without them is infeasible.
+  bool Perturb() {
+    const int last = route_.size() - 1;
+    std::vector<int> positions;
+    for (int position = 1; position < last; ++position) {
+      if (!IsRest(route_[position]))
+        positions.push_back(position);
+    }
+    if (positions.empty())
+      return false;
+    const int size_positions = positions.size();
+    const int length         = std::uniform_int_distribution<int>(
+        1, std::min(size_positions, std::max(3, size_positions / 10)))(generator_);
+    const int first =
+        std::uniform_int_distribution<int>(0, size_positions - length)(generator_);
+    const int begin = positions[first];
+    const int end   = positions[first + length - 1];
+
+    std::vector<Piece> pieces = {Piece(0, begin - 1)};
+    std::vector<int> services;
+    for (int position = begin; position <= end; ++position) {
+      if (IsRest(route_[position]))
+        pieces.push_back(Piece(route_[position]));
+      else
+        services.push_back(route_[position]);
+    }
+    pieces.push_back(Piece(end + 1, last));
+    if (Evaluate(pieces) == kint64max)
+      return false;
+    Apply(pieces);
+    std::shuffle(services.begin(), services.end(), generator_);
+    for (const int service : services)
+      InsertService(service);
+    return true;
+  }
+
+  //  Applies the first improving move, false at a local optimum
+  bool Improve() {
+    const int last = route_.size() - 1;
+
+    // Insertion of unperformed services
+    for (int service = 0; service < size_; ++service) {
+      if (served_[service] || !allowed_[service])
+        continue;
+      for (int after = 0; after < last; ++after) {
+        const std::vector<Piece> pieces = {Piece(0, after), Piece(service),
+                                           Piece(after + 1, last)};
+        const int64 cost = Evaluate(pieces);
+        if (cost != kint64max && (penalties_[service] == kint64max ||
+                                  cost - route_cost_ < penalties_[service])) {
+          Apply(pieces);
+          return true;
+        }
+      }
+    }
+
+    // Relocate and Or-opt, the chain being possibly reversed
+    for (int length = 1; length <= 3; ++length) {
+      for (int begin = 1; begin + length - 1 < last; ++begin) {
+        if (TimeOut())
+          return false;
+        const int end = begin + length - 1;
+        // Positions around the chain, moving away from it so that the inner
+        // piece grows by one item per position
+        for (int step = 0; step < last - length - 1; ++step) {
+          const int after = step < begin - 1 ? begin - 2 - step : end + 2 + step - begin;
+          for (const bool reversed : {false, true}) {
+            if (reversed && length == 1)
+              continue;
+            const std::vector<Piece> pieces =
+                after < begin ? std::vector<Piece>{Piece(0, after),
+                                                   Piece(begin, end, reversed),
+                                                   Piece(after + 1, begin - 1),
+                                                   Piece(end + 1, last)}
+                              : std::vector<Piece>{Piece(0, begin - 1),
+                                                   Piece(end + 1, after),
+                                                   Piece(begin, end, reversed),
+                                                   Piece(after + 1, last)};
+            if (Evaluate(pieces) < route_cost_) {
+              Apply(pieces);
+              return true;
+            }
+          }
+        }
+      }
+    }
+
+    // 2-opt
+    for (int begin = 1; begin < last; ++begin) {
+      if (TimeOut())
+        return false;
+      for (int end = begin + 1; end < last; ++end) {
+        const std::vector<Piece> pieces = {Piece(0, begin - 1), Piece(begin, end, true),
+                                           Piece(end + 1, last)};
+        if (Evaluate(pieces) < route_cost_) {
+          Apply(pieces);
+          return true;
+        }
+      }
+    }
+
+    // Removal of services costing more than their exclusion
+    for (int position = 1; position < last; ++position) {
+      const int item = route_[position];
+      if (IsRest(item) || penalties_[item] == kint64max)
+        continue;
+      const std::vector<Piece> pieces = {Piece(0, position - 1),
+                                         Piece(position + 1, last)};
+      const int64 cost = Evaluate(pieces);
+      if (cost != kint64max && cost + penalties_[item] < route_cost_) {
+        Apply(pieces);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void FillResult(ortools_result::Result* result) const {
+    std::vector<int64> times;
+    Pass pass;
+    Run(route_, departure_, nullptr, &pass);
+    Run(route_, departure_ + pass.shift, &times, &pass);
+
+    std::vector<int64> route;
+    std::vector<int64> start_times;
+    std::vector<std::pair<int64, std::string>> rests;
+    for (std::size_t position = 0; position < route_.size(); ++position) {
+      const int item = route_[position];
+      if (IsRest(item)) {
+        rests.emplace_back(times[position], rest_ids_[item - size_ - 2]);
+      } else {
+        route.push_back(position == 0 ? manager_.GetStartIndex(0)
+                                      : position + 1 == route_.size()
+                                            ? manager_.GetEndIndex(0)
+                                            : manager_.NodeToIndex(Node(item)));
+        start_times.push_back(times[position]);
+      }
+    }
+    std::stable_sort(rests.begin(), rests.end(),
+                     [](const std::pair<int64, std::string>& a,
+                        const std::pair<int64, std::string>& b) {
+                       return a.first < b.first;
+                     });
+
+    if (result->routes_size() > 0)
+      result->clear_routes();
+    AddRouteActivities(data_, manager_, 0, route, start_times,
+                       scheduler_.Quantities(route), rests, result->add_routes());
+
+    int64 cost = route_cost_;
+    for (int i = 0; i < size_; ++i) {
+      if (!served_[i])
+        cost += penalties_[i];
+    }
+    ortools_result::CostDetails* details = result->mutable_cost_details();
+    details->set_fixed(pass.services > 0 ? vehicle_->cost_fixed / CUSTOM_BIGNUM : 0);
+    details->set_time(vehicle_->cost_waiting_time_multiplier * pass.span / CUSTOM_BIGNUM);
+    details->set_distance(vehicle_->cost_distance_multiplier * pass.distance /
+                          CUSTOM_BIGNUM);
+    details->set_time_without_wait(std::max<int64>(vehicle_->cost_time_multiplier -
+                                                       vehicle_->cost_waiting_time_multiplier,
+                                                   0) *
+                                   pass.transit / CUSTOM_BIGNUM);
+    details->set_value(vehicle_->cost_value_multiplier * pass.value / CUSTOM_BIGNUM);
+    result->set_cost(cost / CUSTOM_BIGNUM);
+  }
+
+  const TSPTWDataDT& data_;
+  const RoutingIndexManager& manager_;
+  const TSPTWDataDT::Vehicle* const vehicle_;
+  const int64 horizon_;
+  const std::vector<int64> penalties_;
+  const int64 time_limit_in_ms_;
+  const double start_time_;
+  const int size_;
+  const RouteScheduler scheduler_;
+
+  std::vector<int64> transits_;
+  std::vector<int64> distances_;
+  std::vector<int64> values_;
+  std::vector<std::size_t> units_;
+  std::vector<int64> capacities_;
+  std::vector<std::vector<int64>> quantities_;
+  std::vector<int64> readies_;
+  std::vector<int64> dues_;
+  std::vector<int> window_starts_;
+  std::vector<int64> late_multipliers_;
+  std::vector<bool> allowed_;
+  std::vector<int64> rest_readies_;
+  std::vector<int64> rest_dues_;
+  std::vector<int64> rest_durations_;
+  std::vector<std::string> rest_ids_;
+  int64 departure_;
+  int64 end_due_;
+  int64 distance_limit_;
+  int64 duration_limit_;
+  bool segment_mode_;
+
+  std::vector<Segment> singles_;
+  std::vector<Segment> prefixes_;
+  std::vector<Segment> suffixes_;
+  Segment middle_;
+  int middle_begin_;
+  int middle_end_;
+  bool middle_reversed_;
+  Segment chain_;
+  Segment route_segment_;
+  std::vector<int> route_;
+  std::vector<int> items_;
+  std::vector<bool> served_;
+  int64 route_cost_;
+  int64 iterations_;
+  std::mt19937 generator_;
+};
+} //  namespace operations_research
+
+#endif //  OR_TOOLS_TUTORIALS_CPLUSPLUS_SINGLE_VEHICLE_H
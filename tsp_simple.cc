@@ -16,8 +16,15 @@
 // <http://www.gnu.org/licenses/agpl.html>
 //
 #include <iostream>
+#include <queue>
+#include <tuple>
 
+#include "./constraints.h"
+#include "./exact.h"
+#include "./filters.h"
+#include "./insertion.h"
 #include "./limits.h"
+#include "./single_vehicle.h"
 
 #include "google/protobuf/text_format.h"
 
@@ -40,12 +47,9 @@ bool CheckOverflow(int64 a, int64 b) {
   return false;
 }
 
-void MissionsBuilder(const TSPTWDataDT& data, RoutingModel& routing,
-                     RoutingIndexManager& manager, int64 size, int64 min_start) {
+//  Exclusion cost of the services without one, before their priority factor
+int64 DisjunctionCost(const TSPTWDataDT& data, int64 size) {
   const int size_vehicles = data.Vehicles().size();
-  // const int size_matrix = data.SizeMatrix();
-  const int size_problem = data.SizeProblem();
-
   int64 max_time     = (2 * data.MaxTime() + data.MaxServiceTime()) * data.MaxTimeCost();
   int64 max_distance = 2 * data.MaxDistance() * data.MaxDistanceCost();
   int64 max_value    = 2 * data.MaxValue() * data.MaxValueCost();
@@ -56,17 +60,43 @@ void MissionsBuilder(const TSPTWDataDT& data, RoutingModel& routing,
 
   overflow_danger = overflow_danger || CheckOverflow(data_verif, std::pow(2, 4) * size);
   data_verif      = data_verif * std::pow(2, 4) * size;
+  return !overflow_danger && !CheckOverflow(data_verif, size) ? data_verif
+                                                              : std::pow(2, 52);
+}
+
+//  Exclusion cost of a node, summed over the services merged into it
+int64 NodeExclusionCost(const TSPTWDataDT& data, RoutingIndexManager::NodeIndex i,
+                        int64 disjunction_cost) {
+  const int64 exclusion_cost = data.ExclusionCost(i);
+  const int64 cost           = exclusion_cost == -1
+                         ? disjunction_cost * std::pow(2, 4 - data.Priority(i))
+                         : exclusion_cost;
+  // Merged services share their priority and exclusion cost
+  const int64 services = std::max<int64>(data.AggregatedServices(i).size(), 1);
+  return CheckOverflow(cost, services) ? std::max<int64>(cost, std::pow(2, 52))
+                                       : cost * services;
+}
+
+void MissionsBuilder(const TSPTWDataDT& data, RoutingModel& routing,
+                     RoutingIndexManager& manager, int64 size, int64 min_start) {
+  const int size_vehicles = data.Vehicles().size();
+  // const int size_matrix = data.SizeMatrix();
+  const int size_problem = data.SizeProblem();
+
   RoutingIndexManager::NodeIndex i(0);
-  int32 tw_index = 0;
-  int64 disjunction_cost =
-      !overflow_danger && !CheckOverflow(data_verif, size) ? data_verif : std::pow(2, 52);
+  int32 tw_index         = 0;
+  int64 disjunction_cost = DisjunctionCost(data, size);
 
   for (int activity = 0; activity <= size_problem; ++activity) {
     std::vector<int64>* vect = new std::vector<int64>();
     int32 alternative_size   = data.AlternativeSize(activity);
+    // Removed by the presolve
+    if (alternative_size <= 0) {
+      delete vect;
+      continue;
+    }
 
-    int64 priority       = data.Priority(i);
-    int64 exclusion_cost = data.ExclusionCost(i);
+    const int64 exclusion_cost = NodeExclusionCost(data, i, disjunction_cost);
 
     for (int alternative = 0; alternative < alternative_size; ++alternative) {
       vect->push_back(manager.NodeToIndex(i));
@@ -78,8 +108,11 @@ void MissionsBuilder(const TSPTWDataDT& data, RoutingModel& routing,
       int64 const late_multiplier = data.LateMultiplier(i);
       std::vector<int64> sticky_vehicle = data.VehicleIndices(i);
       std::string service_id            = data.ServiceId(i);
-      if (ready.size() > 0 &&
-          (ready.at(0) > -CUSTOM_MAX_INT || due.at(due.size() - 1) < CUSTOM_MAX_INT)) {
+      if (data.SoftTimeWindowsUnion(i)) {
+        // Lateness over the union of the windows has its own constraint
+        cumul_var->SetMin(*std::min_element(ready.begin(), ready.end()));
+      } else if (ready.size() > 0 && (ready.at(0) > -CUSTOM_MAX_INT ||
+                                      due.at(due.size() - 1) < CUSTOM_MAX_INT)) {
         if (FLAGS_debug) {
           std::cout << "Node " << i << " index " << index << " ["
                     << (ready.at(0) - min_start) << " : "
@@ -123,12 +156,15 @@ void MissionsBuilder(const TSPTWDataDT& data, RoutingModel& routing,
       }
 
       std::vector<bool> refill_quantities = data.RefillQuantities(i);
-      for (std::size_t q = 0; q < data.Quantities(i).size(); ++q) {
+      for (std::size_t q = 0; q < data.Quantities(i).size() && !FLAGS_vector_capacity;
+           ++q) {
         RoutingDimension* quantity_dimension =
             routing.GetMutableDimension("quantity" + std::to_string(q));
         if (!refill_quantities.at(q))
           quantity_dimension->SlackVar(index)->SetValue(0);
-        routing.AddVariableMinimizedByFinalizer(quantity_dimension->CumulVar(index));
+        // Otherwise the quantities are computed once the routes are found
+        if (!PostSolveSchedule())
+          routing.AddVariableMinimizedByFinalizer(quantity_dimension->CumulVar(index));
       }
 
       ++i;
@@ -136,16 +172,13 @@ void MissionsBuilder(const TSPTWDataDT& data, RoutingModel& routing,
 
     if (FLAGS_debug) {
       std::cout << "Activity " << activity << "\t exclusion cost: " << exclusion_cost
-                << "\t disjunction cost: " << disjunction_cost * std::pow(2, 4 - priority)
                 << std::endl;
     }
     // Otherwise this single service is never assigned
     if (size == 1)
       routing.AddDisjunction(*vect);
     else
-      routing.AddDisjunction(*vect, exclusion_cost == -1
-                                        ? disjunction_cost * std::pow(2, 4 - priority)
-                                        : exclusion_cost);
+      routing.AddDisjunction(*vect, exclusion_cost);
 
     delete vect;
   }
@@ -190,16 +223,17 @@ bool RouteBuilder(const TSPTWDataDT& data, RoutingModel& routing,
   return routing.RoutesToAssignment(routes, true, false, assignment);
 }
 
-std::vector<std::vector<IntervalVar*>> RestBuilder(const TSPTWDataDT& data,
-                                                   RoutingModel& routing) {
+std::vector<std::vector<StoredRest>> RestBuilder(const TSPTWDataDT& data,
+                                                 RoutingModel& routing) {
   Solver* solver          = routing.solver();
   const int size_vehicles = data.Vehicles().size();
-  std::vector<std::vector<IntervalVar*>> stored_rests;
+  std::vector<std::vector<StoredRest>> stored_rests;
   for (int vehicle_index = 0; vehicle_index < size_vehicles; ++vehicle_index) {
     const RoutingDimension& time_dimension = routing.GetDimensionOrDie(kTime);
     IntVar* const cumul_var     = time_dimension.CumulVar(routing.Start(vehicle_index));
     IntVar* const cumul_var_end = time_dimension.CumulVar(routing.End(vehicle_index));
     std::vector<IntervalVar*> rest_array;
+    std::vector<StoredRest> vehicle_rests;
     for (TSPTWDataDT::Rest rest : data.Vehicles().at(vehicle_index)->rests) {
       IntervalVar* const rest_interval = solver->MakeFixedDurationIntervalVar(
           std::max(rest.ready_time[0], data.Vehicles().at(vehicle_index)->time_start),
@@ -208,6 +242,7 @@ std::vector<std::vector<IntervalVar*>> RestBuilder(const TSPTWDataDT& data,
           rest.service_time, // Currently only one timewindow
           false, absl::StrCat("Rest/", rest.rest_id, "/", vehicle_index));
       rest_array.push_back(rest_interval);
+      vehicle_rests.emplace_back(rest_interval, rest.rest_id);
       solver->AddConstraint(
           solver->MakeGreaterOrEqual(rest_interval->SafeStartExpr(0), cumul_var));
       solver->AddConstraint(
@@ -216,7 +251,7 @@ std::vector<std::vector<IntervalVar*>> RestBuilder(const TSPTWDataDT& data,
     }
     routing.GetMutableDimension(kTime)->SetBreakIntervalsOfVehicle(
         rest_array, vehicle_index, data.ServiceTimes());
-    stored_rests.push_back(rest_array);
+    stored_rests.push_back(vehicle_rests);
   }
   return stored_rests;
 }
@@ -226,18 +261,6 @@ void RelationBuilder(const TSPTWDataDT& data, RoutingModel& routing,
   Solver* solver = routing.solver();
   // const int size_vehicles = data.Vehicles().size();
 
-  Solver::IndexEvaluator1 vehicle_evaluator = [&data](int64 index) {
-    return data.VehicleDay(index);
-  };
-
-  Solver::IndexEvaluator1 day_to_vehicle_evaluator = [&data](int64 index) {
-    return data.DayIndexToVehicleIndex(index);
-  };
-
-  // Solver::IndexEvaluator1 alternative_vehicle_evaluator = [&data](int64 index) {
-  //   return data.VehicleDayAlt(index);
-  // };
-
   std::vector<IntVar*> next_vars;
   for (int i = 0; i < data.SizeMissions(); ++i) {
     next_vars.push_back(routing.NextVar(i));
@@ -248,55 +271,33 @@ void RelationBuilder(const TSPTWDataDT& data, RoutingModel& routing,
     int64 current_index;
     std::vector<int64> previous_indices;
     std::vector<std::pair<int, int>> pairs;
+    std::vector<int64> linked_indices;
+    for (const std::string& linked_id : *relation->linked_ids)
+      linked_indices.push_back(data.IdIndex(linked_id));
     switch (relation->type) {
     case Sequence:
-      // int64 new_current_index;
+      solver->AddConstraint(MakeLinkedNodesConstraint(routing, linked_indices,
+                                                      ChainedActivity, SameVehicle, true));
       previous_index = data.IdIndex(relation->linked_ids->at(0));
       for (std::size_t link_index = 1; link_index < relation->linked_ids->size();
            ++link_index) {
         current_index = data.IdIndex(relation->linked_ids->at(link_index));
-        IntVar* const previous_active_var = routing.ActiveVar(previous_index);
-        IntVar* const active_var          = routing.ActiveVar(current_index);
-        solver->AddConstraint(solver->MakeLessOrEqual(active_var, previous_active_var));
         routing.AddPickupAndDelivery(previous_index, current_index);
-
-        IntVar* const previous_vehicle_var = routing.VehicleVar(previous_index);
-        IntVar* const vehicle_var          = routing.VehicleVar(current_index);
-        IntExpr* const isConstraintActive =
-            solver->MakeProd(previous_active_var, active_var)->Var();
         routing.NextVar(current_index)->RemoveValues(previous_indices);
-
-        solver->AddConstraint(solver->MakeEquality(
-            solver->MakeProd(isConstraintActive, previous_vehicle_var),
-            solver->MakeProd(isConstraintActive, vehicle_var)));
-        solver->AddConstraint(solver->MakeEquality(
-            solver->MakeProd(isConstraintActive, routing.NextVar(previous_index)),
-            solver->MakeProd(isConstraintActive, current_index)));
         previous_indices.push_back(previous_index);
-        previous_index = data.IdIndex(relation->linked_ids->at(link_index));
+        previous_index = current_index;
       }
       break;
     case Order:
+      solver->AddConstraint(MakeLinkedNodesConstraint(routing, linked_indices,
+                                                      ChainedActivity, SameVehicle));
       previous_index = data.IdIndex(relation->linked_ids->at(0));
       previous_indices.push_back(previous_index);
       for (std::size_t link_index = 1; link_index < relation->linked_ids->size();
            ++link_index) {
         current_index = data.IdIndex(relation->linked_ids->at(link_index));
         pairs.push_back(std::make_pair(previous_index, current_index));
-        // routing.AddPickupAndDelivery(previous_index, current_index);
-        IntVar* const previous_active_var = routing.ActiveVar(previous_index);
-        IntVar* const active_var          = routing.ActiveVar(current_index);
-
-        IntVar* const previous_vehicle_var = routing.VehicleVar(previous_index);
-        IntVar* const vehicle_var          = routing.VehicleVar(current_index);
         routing.NextVar(current_index)->RemoveValues(previous_indices);
-
-        solver->AddConstraint(solver->MakeLessOrEqual(active_var, previous_active_var));
-        IntExpr* const isConstraintActive =
-            solver->MakeProd(previous_active_var, active_var);
-        solver->AddConstraint(solver->MakeEquality(
-            solver->MakeProd(isConstraintActive, previous_vehicle_var),
-            solver->MakeProd(isConstraintActive, vehicle_var)));
         previous_indices.push_back(current_index);
         previous_index = current_index;
       }
@@ -304,93 +305,32 @@ void RelationBuilder(const TSPTWDataDT& data, RoutingModel& routing,
         solver->AddConstraint(solver->MakePathPrecedenceConstraint(next_vars, pairs));
       break;
     case SameRoute:
-      previous_index = data.IdIndex(relation->linked_ids->at(0));
-      for (std::size_t link_index = 1; link_index < relation->linked_ids->size();
-           ++link_index) {
-        current_index = data.IdIndex(relation->linked_ids->at(link_index));
-        IntVar* const previous_active_var = routing.ActiveVar(previous_index);
-        IntVar* const active_var          = routing.ActiveVar(current_index);
-
-        solver->AddConstraint(solver->MakeLessOrEqual(active_var, previous_active_var));
-        IntVar* const previous_vehicle_var = routing.VehicleVar(previous_index);
-        IntVar* const vehicle_var          = routing.VehicleVar(current_index);
-
-        solver->AddConstraint(solver->MakeLessOrEqual(active_var, previous_active_var));
-        IntVar* const isConstraintActive =
-            solver->MakeProd(previous_active_var, active_var)->Var();
-        solver->AddConstraint(solver->MakeEquality(
-            solver->MakeProd(previous_vehicle_var, isConstraintActive),
-            solver->MakeProd(vehicle_var, isConstraintActive)));
-        previous_index = current_index;
-      }
+      solver->AddConstraint(MakeLinkedNodesConstraint(routing, linked_indices,
+                                                      ChainedActivity, SameVehicle));
       break;
     case MinimumDayLapse:
-      previous_index = data.IdIndex(relation->linked_ids->at(0));
-      for (std::size_t link_index = 1; link_index < relation->linked_ids->size();
-           ++link_index) {
-        current_index = data.IdIndex(relation->linked_ids->at(link_index));
-        IntVar* const previous_active_var = routing.ActiveVar(previous_index);
-        IntVar* const active_var          = routing.ActiveVar(current_index);
-        IntVar* const vehicle_var         = routing.VehicleVar(current_index);
-
-        IntVar* const previous_part =
-            solver->MakeElement(vehicle_evaluator, routing.VehicleVar(previous_index))
-                ->Var();
-
-        IntVar* const vehicle_index_var =
-            solver
-                ->MakeElement(day_to_vehicle_evaluator,
-                              solver->MakeSum(previous_part, relation->lapse)->Var())
-                ->Var();
-        solver->AddConstraint(solver->MakeLessOrEqual(active_var, previous_active_var));
-        IntExpr* const isConstraintActive =
-            solver->MakeProd(previous_active_var, active_var);
-
-        solver->AddConstraint(solver->MakeGreaterOrEqual(
-            solver->MakeProd(vehicle_var, isConstraintActive),
-            solver->MakeProd(vehicle_index_var, isConstraintActive)));
-        previous_index = current_index;
-      }
-      break;
     case MaximumDayLapse:
       previous_index = data.IdIndex(relation->linked_ids->at(0));
       for (std::size_t link_index = 1; link_index < relation->linked_ids->size();
            ++link_index) {
         current_index = data.IdIndex(relation->linked_ids->at(link_index));
-        IntVar* const previous_active_var  = routing.ActiveVar(previous_index);
-        IntVar* const active_var           = routing.ActiveVar(current_index);
-        IntVar* const vehicle_var          = routing.VehicleVar(current_index);
-        IntVar* const previous_vehicle_var = routing.VehicleVar(previous_index);
-
-        IntVar* const previous_part =
-            solver->MakeElement(vehicle_evaluator, previous_vehicle_var)->Var();
-
-        IntVar* const vehicle_index_var =
-            solver
-                ->MakeElement(day_to_vehicle_evaluator,
-                              solver->MakeSum(previous_part, relation->lapse)->Var())
-                ->Var();
-        solver->AddConstraint(solver->MakeLessOrEqual(active_var, previous_active_var));
-
-        IntExpr* const isConstraintActive =
-            solver->MakeProd(previous_active_var, active_var);
-        solver->AddConstraint(solver->MakeGreaterOrEqual(
-            solver->MakeProd(vehicle_var, isConstraintActive),
-            solver->MakeProd(previous_vehicle_var, isConstraintActive)));
-        solver->AddConstraint(solver->MakeLessOrEqual(
-            solver->MakeProd(vehicle_var, isConstraintActive),
-            solver->MakeProd(vehicle_index_var, isConstraintActive)));
+        solver->AddConstraint(solver->MakeLessOrEqual(routing.ActiveVar(current_index),
+                                                      routing.ActiveVar(previous_index)));
+        solver->AddConstraint(MakeDayLapseConstraint(
+            routing, previous_index, current_index, data.VehiclesDay(),
+            data.DayFirstVehicles(), relation->lapse,
+            relation->type == MinimumDayLapse ? MinimumLapse : MaximumLapse));
         previous_index = current_index;
       }
       break;
     case Shipment:
+      solver->AddConstraint(
+          MakeLinkedNodesConstraint(routing, linked_indices, EqualActivity, SameVehicle));
       previous_index = data.IdIndex(relation->linked_ids->at(0));
       for (std::size_t link_index = 1; link_index < relation->linked_ids->size();
            ++link_index) {
         current_index = data.IdIndex(relation->linked_ids->at(link_index));
         routing.AddPickupAndDelivery(previous_index, current_index);
-        solver->AddConstraint(solver->MakeEquality(routing.VehicleVar(previous_index),
-                                                   routing.VehicleVar(current_index)));
         solver->AddConstraint(solver->MakeLessOrEqual(
             routing.GetMutableDimension(kTime)->CumulVar(previous_index),
             routing.GetMutableDimension(kTime)->CumulVar(current_index)));
@@ -398,6 +338,8 @@ void RelationBuilder(const TSPTWDataDT& data, RoutingModel& routing,
       }
       break;
     case MeetUp:
+      solver->AddConstraint(MakeLinkedNodesConstraint(routing, linked_indices,
+                                                      FreeActivity, DifferentVehicles));
       previous_index = data.IdIndex(relation->linked_ids->at(0));
       for (std::size_t link_index = 1; link_index < relation->linked_ids->size();
            ++link_index) {
@@ -407,22 +349,9 @@ void RelationBuilder(const TSPTWDataDT& data, RoutingModel& routing,
         IntExpr* const isConstraintActive =
             solver->MakeProd(previous_active_var, active_var)->Var();
 
-        IntExpr* const previous_part =
-            solver->MakeProd(isConstraintActive, routing.VehicleVar(previous_index));
-        IntExpr* const next_part =
-            solver->MakeProd(isConstraintActive, routing.VehicleVar(current_index));
-
-        IntExpr* const lapse = solver->MakeProd(isConstraintActive, 1);
-        solver->AddConstraint(solver->MakeGreaterOrEqual(
-            solver->MakeAbs(solver->MakeDifference(next_part, previous_part)), lapse));
-
-        IntExpr* const previous_part_global_index =
-            solver->MakeElement(vehicle_evaluator, routing.VehicleVar(previous_index));
-        IntExpr* const next_part_global_index =
-            solver->MakeElement(vehicle_evaluator, routing.VehicleVar(current_index));
-
-        solver->AddConstraint(
-            solver->MakeEquality(previous_part_global_index, next_part_global_index));
+        solver->AddConstraint(MakeDayLapseConstraint(routing, previous_index, current_index,
+                                                     data.VehiclesDay(),
+                                                     data.DayFirstVehicles(), 0, SameDay));
 
         solver->AddConstraint(solver->MakeEquality(
             solver->MakeProd(
@@ -559,81 +488,64 @@ void RelationBuilder(const TSPTWDataDT& data, RoutingModel& routing,
   }
 }
 
-void AddBalanceDimensions(const TSPTWDataDT& data, RoutingModel& routing,
-                          RoutingIndexManager& manager, int horizon) {
-  if (FLAGS_balance) {
+//  The time and distance spreads between vehicles are shared variables. Each one
+//  is carried by the end cumul of a vehicle in a single zero transit dimension,
+//  whose soft upper bound adds the spread cost to the objective.
+void AddBalanceDimensions(const TSPTWDataDT& data, RoutingModel& routing) {
+  if (FLAGS_balance && data.Vehicles().size() > 1) {
     std::vector<IntVar*> ends_distance_vars;
     std::vector<IntVar*> shift_vars;
-    std::vector<int> zero_evaluators;
-    Solver* solver = routing.solver();
+    int64 time_multiplier     = 0;
+    int64 distance_multiplier = 0;
+    Solver* solver            = routing.solver();
+    const RoutingDimension& time_dimension     = routing.GetDimensionOrDie(kTime);
+    const RoutingDimension& distance_dimension = routing.GetDimensionOrDie(kDistance);
 
     int v = 0;
     for (TSPTWDataDT::Vehicle* vehicle : data.Vehicles()) {
-      zero_evaluators.push_back(
-          routing.RegisterTransitCallback([vehicle, &manager](int64 i, int64 j) {
-            return vehicle->ReturnZero(manager.IndexToNode(i),
-
-                                       manager.IndexToNode(j));
-          }));
-      const operations_research::RoutingDimension& time_dimension =
-          routing.GetDimensionOrDie(kTime);
-      const operations_research::RoutingDimension& distance_dimension =
-          routing.GetDimensionOrDie(kDistance);
-
-      int64 start_index = routing.Start(v);
-      int64 end_index   = routing.End(v);
-
-      IntVar* const time_cumul_var     = time_dimension.CumulVar(start_index);
-      IntVar* const time_cumul_var_end = time_dimension.CumulVar(end_index);
-      IntVar* const dist_end_cumul_var = distance_dimension.CumulVar(end_index);
-
-      ends_distance_vars.push_back(dist_end_cumul_var);
-      IntVar* const time_difference =
-          solver->MakeDifference(time_cumul_var_end, time_cumul_var)->Var();
-      shift_vars.push_back(time_difference);
+      const int64 start_index = routing.Start(v);
+      const int64 end_index   = routing.End(v);
+      ends_distance_vars.push_back(distance_dimension.CumulVar(end_index));
+      shift_vars.push_back(solver
+                               ->MakeDifference(time_dimension.CumulVar(end_index),
+                                                time_dimension.CumulVar(start_index))
+                               ->Var());
+      time_multiplier += vehicle->cost_time_multiplier;
+      distance_multiplier += vehicle->cost_distance_multiplier;
       ++v;
     }
 
-    routing.AddDimensionWithVehicleTransits(zero_evaluators, horizon, horizon, true,
-                                            kTimeBalance);
-    routing.AddDimensionWithVehicleTransits(zero_evaluators, LLONG_MAX, LLONG_MAX, true,
-                                            kDistanceBalance);
-
-    v = 0;
-    for (TSPTWDataDT::Vehicle* vehicle : data.Vehicles()) {
-      routing.GetMutableDimension(kTimeBalance)
-          ->SetSpanCostCoefficientForVehicle((int64)vehicle->cost_time_multiplier, v);
-      routing.GetMutableDimension(kDistanceBalance)
-          ->SetSpanCostCoefficientForVehicle((int64)vehicle->cost_distance_multiplier, v);
-
-      int64 start_index = routing.Start(v);
-      int64 end_index   = routing.End(v);
-
-      IntVar* const start_time_cumul_var =
-          routing.GetMutableDimension(kTimeBalance)->CumulVar(start_index);
-      IntVar* const end_time_cumul_var =
-          routing.GetMutableDimension(kTimeBalance)->CumulVar(end_index);
-      start_time_cumul_var->SetMax(0);
-      solver->AddConstraint(solver->MakeGreaterOrEqual(
-          end_time_cumul_var, solver->MakeDifference(solver->MakeMax(shift_vars),
-                                                     solver->MakeMin(shift_vars))));
-
-      IntVar* const start_distance_cumul_var =
-          routing.GetMutableDimension(kDistanceBalance)->CumulVar(start_index);
-      IntVar* const end_distance_cumul_var =
-          routing.GetMutableDimension(kDistanceBalance)->CumulVar(end_index);
-      start_distance_cumul_var->SetMax(0);
-      solver->AddConstraint(solver->MakeGreaterOrEqual(
-          end_distance_cumul_var,
-          solver->MakeDifference(solver->MakeMax(ends_distance_vars),
-                                 solver->MakeMin(ends_distance_vars))));
-      ++v;
-    }
+    IntVar* const time_spread =
+        solver
+            ->MakeDifference(solver->MakeMax(shift_vars), solver->MakeMin(shift_vars))
+            ->Var();
+    IntVar* const distance_spread =
+        solver
+            ->MakeDifference(solver->MakeMax(ends_distance_vars),
+                             solver->MakeMin(ends_distance_vars))
+            ->Var();
+
+    const int zero_evaluator =
+        routing.RegisterTransitCallback([](int64, int64) { return 0; });
+    routing.AddDimension(zero_evaluator, 0, LLONG_MAX, false, kBalance);
+    RoutingDimension* const balance_dimension = routing.GetMutableDimension(kBalance);
+
+    IntVar* const time_carrier     = balance_dimension->CumulVar(routing.End(0));
+    IntVar* const distance_carrier = balance_dimension->CumulVar(routing.End(1));
+    solver->AddConstraint(solver->MakeGreaterOrEqual(time_carrier, time_spread));
+    solver->AddConstraint(solver->MakeGreaterOrEqual(distance_carrier, distance_spread));
+    balance_dimension->SetCumulVarSoftUpperBound(routing.End(0), 0, time_multiplier);
+    balance_dimension->SetCumulVarSoftUpperBound(routing.End(1), 0, distance_multiplier);
+    for (v = 2; v < routing.vehicles(); ++v)
+      balance_dimension->CumulVar(routing.Start(v))->SetMax(0);
   }
 }
 
 void AddCapacityDimensions(const TSPTWDataDT& data, RoutingModel& routing,
                            RoutingIndexManager& manager) {
+  // Capacities are then checked by AddVehicleCapacityConstraints
+  if (FLAGS_vector_capacity)
+    return;
   for (std::size_t unit_i = 0; unit_i < data.Vehicles().at(0)->capacity.size();
        ++unit_i) {
     std::vector<int64> capacities;
@@ -800,7 +712,7 @@ void AddValueDimensions(const TSPTWDataDT& data, RoutingModel& routing,
 }
 
 void AddVehicleTimeConstraints(const TSPTWDataDT& data, RoutingModel& routing,
-                               bool& has_route_duration) {
+                               const RouteScheduler& scheduler, bool& has_route_duration) {
   Solver* solver = routing.solver();
   int v          = 0;
   for (TSPTWDataDT::Vehicle* vehicle : data.Vehicles()) {
@@ -826,7 +738,8 @@ void AddVehicleTimeConstraints(const TSPTWDataDT& data, RoutingModel& routing,
                 100);
         IntVar* const slack_var =
             routing.GetMutableDimension(kTime)->SlackVar(start_index);
-        routing.AddVariableMinimizedByFinalizer(slack_var);
+        if (!scheduler.SchedulesTimes(v))
+          routing.AddVariableMinimizedByFinalizer(slack_var);
       }
     }
     if (vehicle->time_end < CUSTOM_MAX_INT) {
@@ -845,7 +758,8 @@ void AddVehicleTimeConstraints(const TSPTWDataDT& data, RoutingModel& routing,
           time_cumul_var_end->SetMin(vehicle->time_end);
           IntVar* const slack_var =
               routing.GetMutableDimension(kTime)->SlackVar(end_index);
-          routing.AddVariableMinimizedByFinalizer(slack_var);
+          if (!scheduler.SchedulesTimes(v))
+            routing.AddVariableMinimizedByFinalizer(slack_var);
         }
       }
     }
@@ -891,7 +805,68 @@ void AddVehicleDistanceConstraints(const TSPTWDataDT& data, RoutingModel& routin
   }
 }
 
-void AddVehicleCapacityConstraints(const TSPTWDataDT& data, RoutingModel& routing) {
+//  All capacity units are checked by a single constraint and filter. Overload
+//  costs are carried by the end cumuls of a zero transit dimension.
+void AddVectorCapacityConstraints(const TSPTWDataDT& data, RoutingModel& routing,
+                                  RoutingIndexManager& manager) {
+  Solver* solver    = routing.solver();
+  bool has_overload = false;
+  for (TSPTWDataDT::Vehicle* vehicle : data.Vehicles()) {
+    for (std::size_t i = 0; i < vehicle->capacity.size(); ++i)
+      has_overload =
+          has_overload || (vehicle->capacity[i] >= 0 && vehicle->overload_multiplier[i] > 0);
+  }
+
+  std::vector<IntVar*> overloads(routing.vehicles(), nullptr);
+  if (has_overload) {
+    const int zero_evaluator =
+        routing.RegisterTransitCallback([](int64, int64) { return 0; });
+    routing.AddDimension(zero_evaluator, 0, LLONG_MAX, false, kOverload);
+    RoutingDimension* const overload_dimension = routing.GetMutableDimension(kOverload);
+    for (int v = 0; v < routing.vehicles(); ++v) {
+      overloads[v] = overload_dimension->CumulVar(routing.End(v));
+      overload_dimension->SetCumulVarSoftUpperBound(routing.End(v), 0, 1);
+    }
+  }
+
+  const VectorCapacity* const capacity = MakeVectorCapacity(data, routing, manager);
+  solver->AddConstraint(MakeVectorCapacityConstraint(routing, capacity, overloads));
+  routing.AddLocalSearchFilter(MakeVectorCapacityFilter(routing, capacity));
+}
+
+//  Services keeping a single node for several soft time windows are late over
+//  the union of their windows. Their late costs are carried by the slacks of a
+//  zero transit dimension, whose end cumuls sum them.
+void AddSoftTimeWindowsUnionConstraints(const TSPTWDataDT& data, RoutingModel& routing,
+                                        RoutingIndexManager& manager) {
+  if (data.MergedTimeWindowsCounter() == 0)
+    return;
+  Solver* solver = routing.solver();
+  const int zero_evaluator =
+      routing.RegisterTransitCallback([](int64, int64) { return 0; });
+  routing.AddDimension(zero_evaluator, LLONG_MAX, LLONG_MAX, true, kLateness);
+  RoutingDimension* const lateness_dimension = routing.GetMutableDimension(kLateness);
+  const RoutingDimension& time_dimension     = routing.GetDimensionOrDie(kTime);
+  for (int64 index = 0; index < routing.Size(); ++index) {
+    const RoutingIndexManager::NodeIndex node = manager.IndexToNode(index);
+    IntVar* const slack_var                   = lateness_dimension->SlackVar(index);
+    if (node.value() >= data.SizeMissions() || !data.SoftTimeWindowsUnion(node)) {
+      slack_var->SetValue(0);
+      continue;
+    }
+    solver->AddConstraint(MakeUnionLatenessConstraint(
+        data, routing, manager, index, time_dimension.CumulVar(index), slack_var));
+  }
+  for (int v = 0; v < routing.vehicles(); ++v)
+    lateness_dimension->SetCumulVarSoftUpperBound(routing.End(v), 0, 1);
+}
+
+void AddVehicleCapacityConstraints(const TSPTWDataDT& data, RoutingModel& routing,
+                                   RoutingIndexManager& manager) {
+  if (FLAGS_vector_capacity) {
+    AddVectorCapacityConstraints(data, routing, manager);
+    return;
+  }
   int v = 0;
   for (TSPTWDataDT::Vehicle* vehicle : data.Vehicles()) {
     int64 end_index = routing.End(v);
@@ -908,6 +883,236 @@ void AddVehicleCapacityConstraints(const TSPTWDataDT& data, RoutingModel& routin
   }
 }
 
+// With sparse matrices only the arcs to the stored neighbours are exact, a mission is
+// followed by a neighbour, a vehicle end or its sequence successor
+std::vector<std::vector<int>> SparseSuccessors(const TSPTWDataDT& data) {
+  std::vector<std::vector<int>> successors(data.SizeMissions());
+  for (int i = 0; i < data.SizeMissions(); ++i) {
+    for (const RoutingIndexManager::NodeIndex neighbour :
+         data.SparseNeighbours(RoutingIndexManager::NodeIndex(i)))
+      successors[i].push_back(neighbour.value());
+  }
+  for (const TSPTWDataDT::Relation* relation : data.Relations()) {
+    if (relation->type != Sequence)
+      continue;
+    for (std::size_t link_index = 1; link_index < relation->linked_ids->size();
+         ++link_index) {
+      const int64 previous = data.IdIndex(relation->linked_ids->at(link_index - 1));
+      const int64 current  = data.IdIndex(relation->linked_ids->at(link_index));
+      if (previous >= 0 && current >= 0)
+        successors[previous].push_back(current);
+    }
+  }
+  return successors;
+}
+
+// Shortest transit times over the services, from the vehicle start when forward or
+// to the vehicle end otherwise. The matrices may not respect the triangle
+// inequality, the direct arc is not a valid bound in general. Without successors
+// every arc between services is followed, otherwise only the given ones.
+std::vector<int64> ShortestTransits(const TSPTWDataDT& data,
+                                    const TSPTWDataDT::Vehicle* vehicle, bool forward,
+                                    const std::vector<std::vector<int>>* successors) {
+  const int size_missions = data.SizeMissions();
+  std::vector<int64> transits(size_missions, CUSTOM_MAX_INT);
+  std::vector<bool> settled(size_missions, false);
+  for (int i = 0; i < size_missions; ++i) {
+    const RoutingIndexManager::NodeIndex node(i);
+    transits[i] = forward ? vehicle->TimePlusServiceTime(vehicle->Start(), node)
+                          : vehicle->TimePlusServiceTime(node, vehicle->Stop());
+  }
+
+  if (successors != nullptr) {
+    // Backward, the arcs are followed from their head
+    std::vector<std::vector<int>> predecessors;
+    if (!forward) {
+      predecessors.resize(size_missions);
+      for (int i = 0; i < size_missions; ++i) {
+        for (const int j : (*successors)[i])
+          predecessors[j].push_back(i);
+      }
+    }
+    const std::vector<std::vector<int>>& arcs = forward ? *successors : predecessors;
+    typedef std::pair<int64, int> Label;
+    std::priority_queue<Label, std::vector<Label>, std::greater<Label>> queue;
+    for (int i = 0; i < size_missions; ++i) {
+      if (transits[i] < CUSTOM_MAX_INT)
+        queue.push(Label(transits[i], i));
+    }
+    while (!queue.empty()) {
+      const int closest = queue.top().second;
+      queue.pop();
+      if (settled[closest])
+        continue;
+      settled[closest] = true;
+      const RoutingIndexManager::NodeIndex closest_node(closest);
+      for (const int i : arcs[closest]) {
+        if (settled[i])
+          continue;
+        const RoutingIndexManager::NodeIndex node(i);
+        const int64 transit = forward ? vehicle->TimePlusServiceTime(closest_node, node)
+                                      : vehicle->TimePlusServiceTime(node, closest_node);
+        if (transits[closest] + transit < transits[i]) {
+          transits[i] = transits[closest] + transit;
+          queue.push(Label(transits[i], i));
+        }
+      }
+    }
+    return transits;
+  }
+
+  for (int iteration = 0; iteration < size_missions; ++iteration) {
+    int closest = -1;
+    for (int i = 0; i < size_missions; ++i) {
+      if (!settled[i] && (closest == -1 || transits[i] < transits[closest]))
+        closest = i;
+    }
+    if (transits[closest] >= CUSTOM_MAX_INT)
+      break;
+    settled[closest] = true;
+    const RoutingIndexManager::NodeIndex closest_node(closest);
+    for (int i = 0; i < size_missions; ++i) {
+      if (settled[i])
+        continue;
+      const RoutingIndexManager::NodeIndex node(i);
+      const int64 transit = forward ? vehicle->TimePlusServiceTime(closest_node, node)
+                                    : vehicle->TimePlusServiceTime(node, closest_node);
+      transits[i] = std::min(transits[i], transits[closest] + transit);
+    }
+  }
+  return transits;
+}
+
+void RestrictToSparseArcs(const TSPTWDataDT& data, RoutingModel& routing,
+                          RoutingIndexManager& manager) {
+  if (!FLAGS_restrict_to_sparse_arcs || !data.IsSparse())
+    return;
+  std::vector<int64> ends;
+  for (std::size_t v = 0; v < data.Vehicles().size(); ++v) {
+    ends.push_back(routing.End(v));
+  }
+  const std::vector<std::vector<int>> sparse_successors = SparseSuccessors(data);
+
+  int64 removed_arcs = 0;
+  for (int i = 0; i < data.SizeMissions(); ++i) {
+    const int64 index = manager.NodeToIndex(RoutingIndexManager::NodeIndex(i));
+    // Staying on itself keeps the mission inactive
+    std::vector<int64> successors(ends);
+    successors.push_back(index);
+    for (const int successor : sparse_successors[i])
+      successors.push_back(manager.NodeToIndex(RoutingIndexManager::NodeIndex(successor)));
+    removed_arcs += routing.NextVar(index)->Size();
+    routing.NextVar(index)->SetValues(successors);
+    removed_arcs -= routing.NextVar(index)->Size();
+  }
+  if (FLAGS_debug)
+    std::cout << "Sparse matrices removed " << removed_arcs << " arcs" << std::endl;
+}
+
+void TightenTimeWindows(const TSPTWDataDT& data, RoutingModel& routing,
+                        RoutingIndexManager& manager, int64 min_start) {
+  // Estimated sparse arcs could be shorter than their true cost, and dense bounds
+  // are quadratic in the number of services
+  if (!FLAGS_tighten_time_windows ||
+      (data.IsSparse() && !FLAGS_restrict_to_sparse_arcs) ||
+      (!data.IsSparse() && data.SizeMissions() > FLAGS_tighten_time_windows_size))
+    return;
+  RoutingDimension* const time_dimension = routing.GetMutableDimension(kTime);
+  const int size_vehicles                = data.Vehicles().size();
+
+  // Vehicles sharing depots and time transits share their bounds
+  typedef std::tuple<int64, int64, int64, int64, float, int64, float, int64> TransitKey;
+  std::map<TransitKey, int> transit_classes;
+  std::vector<int> vehicle_transit_class;
+  std::vector<std::vector<int64>> from_start_transits;
+  std::vector<std::vector<int64>> to_end_transits;
+  // Sparse matrices only allow few arcs, followed from a heap
+  std::vector<std::vector<int>> successors;
+  if (data.IsSparse())
+    successors = SparseSuccessors(data);
+  for (TSPTWDataDT::Vehicle* vehicle : data.Vehicles()) {
+    const TransitKey key(vehicle->problem_matrix_index, vehicle->start_matrix_index,
+                         vehicle->end_matrix_index,
+                         vehicle->max_ride_time_, vehicle->coef_service,
+                         vehicle->additional_service, vehicle->coef_setup,
+                         vehicle->additional_setup);
+    if (!transit_classes.count(key)) {
+      transit_classes[key] = from_start_transits.size();
+      from_start_transits.push_back(ShortestTransits(
+          data, vehicle, true, data.IsSparse() ? &successors : nullptr));
+      to_end_transits.push_back(ShortestTransits(data, vehicle, false,
+                                                 data.IsSparse() ? &successors : nullptr));
+    }
+    vehicle_transit_class.push_back(transit_classes[key]);
+  }
+
+  for (int i = 0; i < data.SizeMissions(); ++i) {
+    const RoutingIndexManager::NodeIndex node(i);
+    std::vector<int64> vehicle_indices = data.VehicleIndices(node);
+    if (vehicle_indices.empty()) {
+      for (int v = 0; v < size_vehicles; ++v)
+        vehicle_indices.push_back(v);
+    }
+
+    int64 earliest = CUSTOM_MAX_INT;
+    int64 latest   = -CUSTOM_MAX_INT;
+    for (int64 v : vehicle_indices) {
+      if (v < 0 || v >= size_vehicles)
+        continue;
+      TSPTWDataDT::Vehicle* vehicle = data.Vehicles().at(v);
+      const int64 from_start        = from_start_transits[vehicle_transit_class[v]][i];
+      const int64 to_end            = to_end_transits[vehicle_transit_class[v]][i];
+      if (from_start >= CUSTOM_MAX_INT || to_end >= CUSTOM_MAX_INT)
+        continue;
+      earliest = std::min(earliest, vehicle->time_start + from_start);
+      if (vehicle->late_multiplier == 0 && vehicle->time_end < CUSTOM_MAX_INT)
+        latest = std::max(latest, vehicle->time_end - to_end);
+      else
+        latest = CUSTOM_MAX_INT;
+    }
+    // No vehicle reaches the service, it stays unperformed
+    if (earliest >= CUSTOM_MAX_INT)
+      continue;
+
+    // Bounds are only applied when the domain keeps a value, as the node may be
+    // unperformed anyway
+    const int64 index       = manager.NodeToIndex(node);
+    IntVar* const cumul_var = time_dimension->CumulVar(index);
+    const int64 min         = cumul_var->Min();
+    const int64 max         = cumul_var->Max();
+    if (earliest > cumul_var->Min() && earliest <= cumul_var->Max())
+      cumul_var->SetMin(earliest);
+    if (latest < cumul_var->Max() && latest >= cumul_var->Min())
+      cumul_var->SetMax(latest);
+    if (FLAGS_debug && (min != cumul_var->Min() || max != cumul_var->Max())) {
+      std::cout << "Node " << node << " index " << index << " tightened ["
+                << (min - min_start) << " : " << (max - min_start) << "] -> ["
+                << (cumul_var->Min() - min_start) << " : "
+                << (cumul_var->Max() - min_start) << "]" << std::endl;
+    }
+  }
+
+  // A route never ends before its start nor starts after its hard end
+  int v = 0;
+  for (TSPTWDataDT::Vehicle* vehicle : data.Vehicles()) {
+    IntVar* const start_cumul_var = time_dimension->CumulVar(routing.Start(v));
+    IntVar* const end_cumul_var   = time_dimension->CumulVar(routing.End(v));
+    if (vehicle->late_multiplier == 0 && vehicle->time_end < start_cumul_var->Max() &&
+        vehicle->time_end >= start_cumul_var->Min())
+      start_cumul_var->SetMax(vehicle->time_end);
+    if (vehicle->time_start > end_cumul_var->Min() &&
+        vehicle->time_start <= end_cumul_var->Max())
+      end_cumul_var->SetMin(vehicle->time_start);
+    if (FLAGS_debug) {
+      std::cout << "Vehicle " << v << " start [" << (start_cumul_var->Min() - min_start)
+                << " : " << (start_cumul_var->Max() - min_start) << "] end ["
+                << (end_cumul_var->Min() - min_start) << " : "
+                << (end_cumul_var->Max() - min_start) << "]" << std::endl;
+    }
+    ++v;
+  }
+}
+
 void SetFirstSolutionStrategy(const TSPTWDataDT& data,
                               RoutingSearchParameters& parameters,
                               ShiftPref shift_preference, bool has_overall_duration,
@@ -973,8 +1178,127 @@ void SetFirstSolutionStrategy(const TSPTWDataDT& data,
   // parameters.set_first_solution_strategy(FirstSolutionStrategy::PATH_MOST_CONSTRAINED_ARC);
 }
 
-int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
-  ortools_result::Result result;
+// Transit lookups between each node and its closest nodes, as local search does.
+// Compare the throughput with and without -matrix_reordering.
+void BenchmarkTransits(const TSPTWDataDT& data) {
+  const int size_missions = data.SizeMissions();
+  if (size_missions < 2 || data.Vehicles().empty())
+    return;
+  const TSPTWDataDT::Vehicle* vehicle = data.Vehicles().at(0);
+  const int size_neighbors            = std::min(20, size_missions - 1);
+
+  std::vector<std::vector<int>> neighbors(size_missions);
+  for (int i = 0; i < size_missions; ++i) {
+    const RoutingIndexManager::NodeIndex node(i);
+    std::vector<int> nodes;
+    for (int j = 0; j < size_missions; ++j) {
+      if (j != i)
+        nodes.push_back(j);
+    }
+    std::partial_sort(nodes.begin(), nodes.begin() + size_neighbors, nodes.end(),
+                      [vehicle, node](int a, int b) {
+                        return vehicle->Time(node, RoutingIndexManager::NodeIndex(a)) <
+                               vehicle->Time(node, RoutingIndexManager::NodeIndex(b));
+                      });
+    neighbors[i].assign(nodes.begin(), nodes.begin() + size_neighbors);
+  }
+
+  const double start_time = absl::GetCurrentTimeNanos();
+  int64 lookups           = 0;
+  int64 checksum          = 0;
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < size_missions; ++i) {
+      for (int j : neighbors[i]) {
+        checksum += vehicle->TimePlusServiceTime(RoutingIndexManager::NodeIndex(i),
+                                                 RoutingIndexManager::NodeIndex(j));
+        ++lookups;
+      }
+    }
+  }
+  const double duration = 1e-9 * (absl::GetCurrentTimeNanos() - start_time);
+  std::cout << "Transit lookups : " << lookups << " Time : " << duration
+            << " Throughput : " << lookups / std::max(duration, 1e-9) / 1e6
+            << "M/s Checksum : " << checksum << std::endl;
+}
+
+//  Penalties of the unperformed services, as set on the disjunctions
+std::vector<int64> ExclusionPenalties(const TSPTWDataDT& data) {
+  const int64 disjunction_cost = DisjunctionCost(data, data.Size() - 2);
+  std::vector<int64> penalties;
+  for (int i = 0; i < data.SizeMissions(); ++i) {
+    if (data.Size() - 2 == 1)
+      penalties.push_back(kint64max);
+    else
+      penalties.push_back(
+          NodeExclusionCost(data, RoutingIndexManager::NodeIndex(i), disjunction_cost));
+  }
+  return penalties;
+}
+
+//  Solves the problem without building the routing model, exactly when it is
+//  tiny, by local search when a single vehicle serves it. Returns false when
+//  the problem is out of reach of both. Without a filename nothing is written,
+//  the solution is only kept in result.
+bool DirectSolve(const TSPTWDataDT& data, const RoutingIndexManager& manager,
+                 int64 horizon, int64 time_limit_in_ms, const std::string& filename,
+                 ortools_result::Result* result) {
+  const double start_time = absl::GetCurrentTimeNanos();
+  const std::vector<int64> penalties = ExclusionPenalties(data);
+
+  ExactSolver exact_solver(data, manager, horizon, penalties);
+  if (exact_solver.Applicable()) {
+    std::cout << "Exact dynamic programming on " << data.SizeMissions() << " services"
+              << std::endl;
+    if (!exact_solver.Solve(result)) {
+      std::cout << "No solution found..." << std::endl;
+      return true;
+    }
+    result->set_iterations(1);
+  } else if (data.Vehicles().size() == 1) {
+    SingleVehicleSolver single_vehicle_solver(data, manager, horizon, penalties,
+                                              time_limit_in_ms);
+    if (!single_vehicle_solver.Applicable())
+      return false;
+    std::cout << "Single vehicle local search on " << data.SizeMissions() << " services"
+              << std::endl;
+    if (!single_vehicle_solver.Solve(result)) {
+      std::cout << "Single vehicle local search failed, back to the routing model"
+                << std::endl;
+      result->Clear();
+      return false;
+    }
+    result->set_iterations(single_vehicle_solver.Iterations());
+  } else {
+    return false;
+  }
+
+  for (const std::string& service_id : data.InfeasibleServiceIds())
+    result->add_unassigned_ids(service_id);
+  RestoreVehiclePositions(data, result);
+  result->set_duration(1e-9 * (absl::GetCurrentTimeNanos() - start_time));
+
+  if (!filename.empty()) {
+    std::fstream output(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!result->SerializeToOstream(&output)) {
+      std::cout << "Failed to write result." << std::endl;
+      return true;
+    }
+    output.close();
+  }
+
+  std::cout << "Final Iteration : " << result->iterations() << " Cost : " << result->cost()
+            << " Time : " << result->duration() << std::endl;
+  return true;
+}
+
+int TSPTWSolver(const TSPTWDataDT& data, std::string filename,
+                ortools_result::Result* level_result = NULL,
+                int64 time_limit_in_ms = FLAGS_time_limit_in_ms) {
+  ortools_result::Result local_result;
+  ortools_result::Result& result = level_result != NULL ? *level_result : local_result;
+
+  if (FLAGS_benchmark_transits)
+    BenchmarkTransits(data);
 
   const int size_vehicles   = data.Vehicles().size();
   const int size            = data.Size();
@@ -1001,7 +1325,6 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
   }
 
   RoutingIndexManager manager(size, size_vehicles, *start_ends);
-  RoutingModel routing(manager);
 
   int64 maximum_route_distance = 0;
   int64 v                      = 0;
@@ -1018,19 +1341,33 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
   const int64 horizon =
       data.Horizon() * (has_lateness && !CheckOverflow(data.Horizon(), 2) ? 2 : 1);
 
+  const double direct_start = absl::GetCurrentTimeNanos();
+  if (DirectSolve(data, manager, horizon, time_limit_in_ms, filename, &result)) {
+    delete start_ends;
+    return 0;
+  }
+  // The routing model only gets what is left once the direct solvers gave up
+  if (time_limit_in_ms > 0) {
+    const int64 elapsed = 1e-6 * (absl::GetCurrentTimeNanos() - direct_start);
+    time_limit_in_ms    = std::max<int64>(time_limit_in_ms - elapsed, 1);
+  }
+
+  RoutingModel routing(manager);
+
   AddTimeDimensions(data, routing, manager, horizon, free_approach_return);
   AddDistanceDimensions(data, routing, manager, maximum_route_distance,
                         free_approach_return);
-  AddBalanceDimensions(data, routing, manager, horizon);
+  AddBalanceDimensions(data, routing);
   AddCapacityDimensions(data, routing, manager);
   AddValueDimensions(data, routing, manager);
 
   Solver* solver         = routing.solver();
   Assignment* assignment = routing.solver()->MakeAssignment();
 
-  AddVehicleTimeConstraints(data, routing, has_route_duration);
+  const RouteScheduler scheduler(data, manager, PostSolveSchedule());
+  AddVehicleTimeConstraints(data, routing, scheduler, has_route_duration);
   AddVehicleDistanceConstraints(data, routing);
-  AddVehicleCapacityConstraints(data, routing);
+  AddVehicleCapacityConstraints(data, routing, manager);
 
   v               = 0;
   int64 min_start = CUSTOM_MAX_INT;
@@ -1042,7 +1379,7 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
   }
 
   std::vector<IntVar*> used_vehicles;
-  if (FLAGS_vehicle_limit > 0) {
+  if (FLAGS_vehicle_limit > 0 || FLAGS_break_vehicle_symmetry) {
     v = 0;
     for (TSPTWDataDT::Vehicle* vehicle : data.Vehicles()) {
       int64 start_index = routing.Start(v);
@@ -1056,11 +1393,39 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
       used_vehicles.push_back(is_vehicle_used);
       ++v;
     }
+  }
 
+  if (FLAGS_vehicle_limit > 0) {
     solver->AddConstraint(solver->MakeLessOrEqual(solver->MakeSum(used_vehicles),
                                                   (int64)FLAGS_vehicle_limit));
   }
 
+  VehicleSymmetryFilter* symmetry_filter = NULL;
+  if (FLAGS_break_vehicle_symmetry) {
+    // Identical vehicles are used in order
+    std::map<int32, int> previous_vehicles;
+    for (std::size_t vehicle = 0; vehicle < data.Vehicles().size(); ++vehicle) {
+      const int32 symmetry_class = data.Vehicles().at(vehicle)->symmetry_class;
+      if (symmetry_class == -1)
+        continue;
+      if (previous_vehicles.count(symmetry_class))
+        solver->AddConstraint(solver->MakeLessOrEqual(
+            used_vehicles[vehicle], used_vehicles[previous_vehicles[symmetry_class]]));
+      previous_vehicles[symmetry_class] = vehicle;
+    }
+    symmetry_filter = MakeVehicleSymmetryFilter(data, routing);
+    routing.AddLocalSearchFilter(symmetry_filter);
+  }
+
+  RelationFilter* relation_filter = NULL;
+  if (FLAGS_relation_filters && data.Relations().size() > 0) {
+    relation_filter = MakeRelationFilter(data, routing, manager);
+    routing.AddLocalSearchFilter(relation_filter);
+  }
+
+  if (FLAGS_time_window_filter)
+    routing.AddLocalSearchFilter(MakeTimeWindowFilter(data, routing, manager));
+
   // Setting solve parameters indicators
   int64 previous_distance_depot_start = -1;
   int64 previous_distance_depot_end   = -1;
@@ -1068,7 +1433,7 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
   bool loop_route                     = true;
   bool unique_configuration           = true;
   RoutingIndexManager::NodeIndex compareNodeIndex =
-      manager.IndexToNode(rand() % (data.SizeMatrix() - 2));
+      manager.IndexToNode(rand() % std::max(data.SizeMatrix() - 2, 1));
   TSPTWDataDT::Vehicle* previous_vehicle = NULL;
   for (int route_nbr = 0; route_nbr < routing.vehicles(); route_nbr++) {
     TSPTWDataDT::Vehicle* vehicle = data.Vehicles().at(route_nbr);
@@ -1104,7 +1469,10 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
 
   // Setting visit time windows
   MissionsBuilder(data, routing, manager, size - 2, min_start);
-  std::vector<std::vector<IntervalVar*>> stored_rests = RestBuilder(data, routing);
+  AddSoftTimeWindowsUnionConstraints(data, routing, manager);
+  TightenTimeWindows(data, routing, manager, min_start);
+  RestrictToSparseArcs(data, routing, manager);
+  RouteExtractor extractor(data, routing, manager, RestBuilder(data, routing));
   RelationBuilder(data, routing, has_overall_duration);
   RoutingSearchParameters parameters = DefaultRoutingSearchParameters();
 
@@ -1120,8 +1488,8 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
   // parameters.set_local_search_metaheuristic(LocalSearchMetaheuristic::GENERIC_TABU_SEARCH);
 
   const Assignment* solution;
-  if (FLAGS_time_limit_in_ms > 0) {
-    CHECK_OK(util_time::EncodeGoogleApiProto(absl::Milliseconds(FLAGS_time_limit_in_ms),
+  if (time_limit_in_ms > 0) {
+    CHECK_OK(util_time::EncodeGoogleApiProto(absl::Milliseconds(time_limit_in_ms),
                                              parameters.mutable_time_limit()));
   }
 
@@ -1136,9 +1504,40 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
 
   bool build_route = RouteBuilder(data, routing, manager, assignment);
 
+  Assignment* insertion_assignment = NULL;
+  RegretInsertion insertion(data, manager, horizon, FLAGS_regret_insertion);
+  if ((FLAGS_regret_insertion > 0 || (FLAGS_block_insertion && insertion.HasBlocks())) &&
+      !(data.Routes().size() > 0 && build_route)) {
+    if (insertion.Applicable()) {
+      const double insertion_start = absl::GetCurrentTimeNanos();
+      std::vector<std::vector<int64>> routes;
+      insertion.Build(&routes);
+      insertion_assignment = solver->MakeAssignment();
+      if (!routing.RoutesToAssignment(routes, true, true, insertion_assignment) ||
+          !solver->CheckAssignment(insertion_assignment))
+        insertion_assignment = NULL;
+      std::cout << "Regret insertion " << (insertion_assignment != NULL ? "built" : "failed")
+                << " in " << 1e-9 * (absl::GetCurrentTimeNanos() - insertion_start)
+                << "s" << std::endl;
+    }
+  }
+
+  for (const std::string& service_id : data.InfeasibleServiceIds())
+    result.add_unassigned_ids(service_id);
+  if (data.InfeasibleServiceIds().size() > 0)
+    std::cout << "Presolve removed " << data.InfeasibleServiceIds().size()
+              << " infeasible services" << std::endl;
+  if (data.RemovedVehicles().size() > 0)
+    std::cout << "Presolve removed " << data.RemovedVehicles().size()
+              << " surplus vehicles" << std::endl;
+  if (data.MergedTimeWindowsCounter() > 0)
+    std::cout << "Soft time windows union saved " << data.MergedTimeWindowsCounter()
+              << " nodes" << std::endl;
+
   LoggerMonitor* const logger = MakeLoggerMonitor(
       data, &routing, &manager, min_start, size_matrix, FLAGS_debug,
-      FLAGS_intermediate_solutions, &result, stored_rests, filename, true);
+      FLAGS_intermediate_solutions && !filename.empty(), &result, &extractor, filename,
+      true);
   routing.AddSearchMonitor(logger);
 
   if (data.Size() > 3) {
@@ -1158,6 +1557,9 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
       routing.solver()->CheckAssignment(assignment)) {
     std::cout << "Using initial solution provided." << std::endl;
     solution = routing.SolveFromAssignmentWithParameters(assignment, parameters);
+  } else if (insertion_assignment != NULL) {
+    std::cout << "First solution : regret insertion" << std::endl;
+    solution = routing.SolveFromAssignmentWithParameters(insertion_assignment, parameters);
   } else {
     std::cout << "First solution strategy : "
               << FirstSolutionStrategy::Value_Name(parameters.first_solution_strategy())
@@ -1171,129 +1573,47 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
     std::cout << "Failures: " << solver->failures() << std::endl;
     std::cout << "Branches: " << solver->branches() << std::endl;
     std::cout << "Wall time: " << solver->wall_time() << "ms" << std::endl;
+    if (symmetry_filter != NULL)
+      std::cout << "Symmetric moves filtered: " << symmetry_filter->FilteredMoves()
+                << std::endl;
+    if (relation_filter != NULL) {
+      const std::vector<std::pair<RelationType, std::string>> relation_types = {
+          {Sequence, "Sequence"},
+          {Order, "Order"},
+          {SameRoute, "SameRoute"},
+          {MaximumDurationLapse, "MaximumDurationLapse"},
+          {VehicleTrips, "VehicleTrips"}};
+      for (const auto& relation_type : relation_types)
+        std::cout << relation_type.second << " moves filtered/accepted: "
+                  << relation_filter->FilteredMoves(relation_type.first) << "/"
+                  << relation_filter->AcceptedMoves(relation_type.first) << std::endl;
+    }
     std::cout << std::endl;
   }
 
   if (solution != NULL) {
-    if (result.routes_size() > 0)
-      result.clear_routes();
-
-    double total_time_order_cost(0), total_distance_order_cost(0);
-
-    for (int route_nbr = 0; route_nbr < routing.vehicles(); route_nbr++) {
-      std::vector<IntervalVar*> rests = stored_rests.at(route_nbr);
-      ortools_result::Route* route    = result.add_routes();
-      int previous_index              = -1;
-      int previous_start_time         = 0;
-      for (int64 index = routing.Start(route_nbr); !routing.IsEnd(index);
-           index       = solution->Value(routing.NextVar(index))) {
-        for (std::vector<IntervalVar*>::iterator it = rests.begin(); it != rests.end();) {
-          int64 rest_start_time = solution->StartValue(*it);
-          if (solution->PerformedValue(*it) && previous_index != -1 &&
-              rest_start_time >= previous_start_time &&
-              rest_start_time <=
-                  solution->Min(routing.GetMutableDimension(kTime)->CumulVar(index))) {
-            std::stringstream ss((*it)->name());
-            std::string item;
-            std::vector<std::string> parsed_name;
-            while (std::getline(ss, item, '/')) {
-              parsed_name.push_back(item);
-            }
+    extractor.Extract(solution, true, &result);
 
-            ortools_result::Activity* rest = route->add_activities();
-            rest->set_type("break");
-            rest->set_id(parsed_name[1]);
-            rest->set_start_time(rest_start_time);
-            it = rests.erase(it);
-          } else {
-            ++it;
-          }
-        }
+    CostBreakdown costs(routing);
+    costs.Fill(solution, result.mutable_cost_details());
 
-        ortools_result::Activity* activity       = route->add_activities();
-        RoutingIndexManager::NodeIndex nodeIndex = manager.IndexToNode(index);
-        activity->set_start_time(
-            solution->Min(routing.GetMutableDimension(kTime)->CumulVar(index)));
-        activity->set_current_distance(
-            solution->Min(routing.GetMutableDimension(kDistance)->CumulVar(index)));
-        if (previous_index == -1)
-          activity->set_type("start");
-        else {
-          activity->set_type("service");
-          activity->set_id(data.ServiceId(nodeIndex));
-          activity->set_index(data.ProblemIndex(nodeIndex));
-          activity->set_alternative(data.AlternativeIndex(nodeIndex));
-        }
-        for (std::size_t q = 0;
-             q < data.Quantities(RoutingIndexManager::NodeIndex(0)).size(); ++q) {
-          double exchange =
-              solution->Min(routing.GetMutableDimension("quantity" + std::to_string(q))
-                                ->CumulVar(solution->Value(routing.NextVar(index))));
-          activity->add_quantities(exchange);
-        }
-        previous_index = index;
-        previous_start_time =
-            solution->Min(routing.GetMutableDimension(kTime)->CumulVar(index));
-      }
-
-      for (std::vector<IntervalVar*>::iterator it = rests.begin(); it != rests.end();
-           ++it) {
-        int64 rest_start_time = solution->StartValue(*it);
-        if (solution->PerformedValue(*it)) {
-          ortools_result::Activity* rest = route->add_activities();
-          std::stringstream ss((*it)->name());
-          std::string item;
-          std::vector<std::string> parsed_name;
-          while (std::getline(ss, item, '/')) {
-            parsed_name.push_back(item);
-          }
-          rest->set_type("break");
-          rest->set_id(parsed_name[1]);
-          rest->set_start_time(rest_start_time);
-        }
-      }
-      ortools_result::Activity* end_activity = route->add_activities();
-      RoutingIndexManager::NodeIndex nodeIndex =
-          manager.IndexToNode(routing.End(route_nbr));
-      end_activity->set_index(data.ProblemIndex(nodeIndex));
-      end_activity->set_start_time(solution->Min(
-          routing.GetMutableDimension(kTime)->CumulVar(routing.End(route_nbr))));
-      end_activity->set_current_distance(solution->Min(
-          routing.GetMutableDimension(kDistance)->CumulVar(routing.End(route_nbr))));
-      end_activity->set_type("end");
-
-      if (FLAGS_nearby) {
-        total_time_order_cost +=
-            (solution->Min(routing.GetMutableDimension(kTimeOrder)
-                              ->CumulVar(routing.End(route_nbr))) -
-            solution->Max(routing.GetMutableDimension(kTimeOrder)
-                              ->CumulVar(routing.Start(route_nbr))) ) *
-            routing.GetMutableDimension(kTimeOrder)
-                ->GetSpanCostCoefficientForVehicle(route_nbr);
-
-        total_distance_order_cost +=
-            (solution->Min(routing.GetMutableDimension(kDistanceOrder)
-                              ->CumulVar(routing.End(route_nbr))) -
-            solution->Max(routing.GetMutableDimension(kDistanceOrder)
-                              ->CumulVar(routing.Start(route_nbr))) ) *
-            routing.GetMutableDimension(kDistanceOrder)
-                ->GetSpanCostCoefficientForVehicle(route_nbr);
-      }
-    }
+    RestoreVehiclePositions(data, &result);
 
     std::vector<double> scores = logger->GetFinalScore();
-    result.set_cost(
-        (solution->ObjectiveValue() - total_time_order_cost - total_distance_order_cost) /
-        CUSTOM_BIGNUM);
+    result.set_cost(solution->ObjectiveValue() / CUSTOM_BIGNUM -
+                    (result.cost_details().time_order() +
+                     result.cost_details().distance_order()));
     result.set_duration(scores[1]);
     result.set_iterations(scores[2]);
 
-    std::fstream output(filename, std::ios::out | std::ios::trunc | std::ios::binary);
-    if (!result.SerializeToOstream(&output)) {
-      std::cout << "Failed to write result." << std::endl;
-      return -1;
+    if (!filename.empty()) {
+      std::fstream output(filename, std::ios::out | std::ios::trunc | std::ios::binary);
+      if (!result.SerializeToOstream(&output)) {
+        std::cout << "Failed to write result." << std::endl;
+        return -1;
+      }
+      output.close();
     }
-    output.close();
 
     std::cout << "Final Iteration : " << result.iterations()
               << " Cost : " << result.cost() << " Time : " << result.duration()
@@ -1302,11 +1622,242 @@ int TSPTWSolver(const TSPTWDataDT& data, std::string filename) {
     std::cout << "No solution found..." << std::endl;
   }
 
-  google::protobuf::ShutdownProtobufLibrary();
   delete start_ends;
   return 0;
 }
 
+// Merges each service with its closest compatible service, the pair becomes one
+// service whose time window lets both start on time. Candidates are the stored
+// neighbours with sparse matrices, every other service otherwise. Returns false
+// when nothing could be merged.
+bool CoarsenProblem(const ortools_vrp::Problem& problem, int level,
+                    ortools_vrp::Problem* coarse_problem,
+                    std::map<std::string, std::vector<std::string>>* children) {
+  *coarse_problem = problem;
+  coarse_problem->clear_services();
+  coarse_problem->clear_routes();
+  if (problem.matrices_size() == 0)
+    return false;
+  const ortools_vrp::Matrix& matrix = problem.matrices(0);
+  const bool sparse                 = matrix.neighbour_size() > 0;
+  const int32 size_matrix           = sqrt(matrix.time_size());
+  if (!sparse && size_matrix == 0)
+    return false;
+
+  // Relations and alternatives refer to the individual services
+  std::set<std::string> related_ids;
+  for (const ortools_vrp::Relation& relation : problem.relations()) {
+    for (const std::string& linked_id : relation.linked_ids())
+      related_ids.insert(linked_id);
+  }
+  std::map<int32, int32> problem_index_count;
+  for (const ortools_vrp::Service& service : problem.services())
+    ++problem_index_count[service.problem_index()];
+
+  const int size_services = problem.services_size();
+  std::vector<bool> mergeable(size_services, false);
+  std::vector<std::vector<int32>> vehicle_indices(size_services);
+  std::vector<std::vector<int>> point_services;
+  for (int i = 0; i < size_services; ++i) {
+    const ortools_vrp::Service& service = problem.services(i);
+    bool refill                         = false;
+    for (const bool refill_quantity : service.refill_quantities())
+      refill |= refill_quantity;
+    mergeable[i] = !related_ids.count(service.id()) &&
+                   problem_index_count[service.problem_index()] == 1 &&
+                   service.late_multiplier() == 0 && service.time_windows_size() <= 1 &&
+                   !refill && service.matrix_index() >= 0;
+    vehicle_indices[i].assign(service.vehicle_indices().begin(),
+                              service.vehicle_indices().end());
+    std::sort(vehicle_indices[i].begin(), vehicle_indices[i].end());
+    if (sparse && mergeable[i]) {
+      if (service.matrix_index() >= static_cast<int32>(point_services.size()))
+        point_services.resize(service.matrix_index() + 1);
+      point_services[service.matrix_index()].push_back(i);
+    }
+  }
+
+  auto ready_time = [](const ortools_vrp::Service& service) {
+    return service.time_windows_size() > 0
+               ? std::max(service.time_windows(0).start(), -CUSTOM_MAX_INT)
+               : -CUSTOM_MAX_INT;
+  };
+  auto due_time = [](const ortools_vrp::Service& service) {
+    return service.time_windows_size() > 0
+               ? std::min(service.time_windows(0).end(), CUSTOM_MAX_INT)
+               : CUSTOM_MAX_INT;
+  };
+
+  // Pairs, the first service of each one being followed by its partner
+  std::vector<int> partners(size_services, -1);
+  std::vector<bool> firsts(size_services, false);
+  std::vector<int64> pair_times(size_services, 0);
+  std::vector<int64> pair_starts(size_services, 0);
+  std::vector<int64> pair_ends(size_services, 0);
+  std::vector<std::pair<int, int64>> candidates;
+  for (int i = 0; i < size_services; ++i) {
+    if (!mergeable[i] || partners[i] >= 0)
+      continue;
+    const ortools_vrp::Service& service = problem.services(i);
+    const int32 from                    = service.matrix_index();
+    candidates.clear();
+    if (sparse) {
+      if (from < static_cast<int32>(point_services.size())) {
+        for (const int j : point_services[from])
+          candidates.emplace_back(j, 0);
+      }
+      const int64 first = static_cast<int64>(from) * matrix.neighbour_size();
+      for (int64 n = first;
+           n < std::min<int64>(first + matrix.neighbour_size(), matrix.neighbours_size());
+           ++n) {
+        const uint32 to = matrix.neighbours(n);
+        if (to >= point_services.size() || static_cast<int32>(to) == from)
+          continue;
+        const int64 time =
+            n < matrix.neighbour_time_size() ? matrix.neighbour_time(n) + 0.5 : 0;
+        for (const int j : point_services[to])
+          candidates.emplace_back(j, time);
+      }
+    } else if (from < size_matrix) {
+      for (int j = 0; j < size_services; ++j) {
+        const int32 to = problem.services(j).matrix_index();
+        if (mergeable[j] && to >= 0 && to < size_matrix)
+          candidates.emplace_back(
+              j, static_cast<int64>(matrix.time(from * size_matrix + to) + 0.5));
+      }
+    }
+
+    int closest        = -1;
+    int64 closest_time = CUSTOM_MAX_INT;
+    int64 start        = ready_time(service);
+    int64 end          = due_time(service);
+    for (const std::pair<int, int64>& candidate : candidates) {
+      const int j      = candidate.first;
+      const int64 time = candidate.second;
+      if (j == i || partners[j] >= 0 || time >= closest_time ||
+          vehicle_indices[i] != vehicle_indices[j])
+        continue;
+      const ortools_vrp::Service& other = problem.services(j);
+      // The second service starts after the first one and the travel between them
+      const int64 shift       = service.duration() + time;
+      const int64 other_start = ready_time(other) > -CUSTOM_MAX_INT
+                                    ? ready_time(other) - shift
+                                    : -CUSTOM_MAX_INT;
+      const int64 other_end =
+          due_time(other) < CUSTOM_MAX_INT ? due_time(other) - shift : CUSTOM_MAX_INT;
+      if (std::max(ready_time(service), other_start) >
+          std::min(due_time(service), other_end))
+        continue;
+      closest      = j;
+      closest_time = time;
+      start        = std::max(ready_time(service), other_start);
+      end          = std::min(due_time(service), other_end);
+    }
+    if (closest == -1)
+      continue;
+    partners[i]       = closest;
+    partners[closest] = i;
+    firsts[i]         = true;
+    pair_times[i]     = closest_time;
+    pair_starts[i]    = start;
+    pair_ends[i]      = end;
+  }
+
+  int merges = 0;
+  for (int i = 0; i < size_services; ++i) {
+    if (partners[i] >= 0 && !firsts[i])
+      continue;
+    const ortools_vrp::Service& service  = problem.services(i);
+    ortools_vrp::Service* coarse_service = coarse_problem->add_services();
+    *coarse_service                      = service;
+    if (partners[i] == -1)
+      continue;
+
+    const ortools_vrp::Service& other = problem.services(partners[i]);
+    const int64 start                 = pair_starts[i];
+    const int64 end                   = pair_ends[i];
+    coarse_service->set_id(absl::StrCat("multilevel/", level, "/", merges++));
+    coarse_service->set_duration(service.duration() + pair_times[i] + other.duration());
+    coarse_service->set_additional_value(service.additional_value() +
+                                         other.additional_value());
+    coarse_service->set_priority(std::min(service.priority(), other.priority()));
+    coarse_service->clear_time_windows();
+    if (start > -CUSTOM_MAX_INT || end < CUSTOM_MAX_INT) {
+      ortools_vrp::TimeWindow* timewindow = coarse_service->add_time_windows();
+      timewindow->set_start(start);
+      timewindow->set_end(end);
+    }
+    for (int unit_i = 0; unit_i < other.quantities_size(); ++unit_i) {
+      if (unit_i < coarse_service->quantities_size())
+        coarse_service->set_quantities(unit_i, coarse_service->quantities(unit_i) +
+                                                   other.quantities(unit_i));
+      else
+        coarse_service->add_quantities(other.quantities(unit_i));
+    }
+    (*children)[coarse_service->id()] = {service.id(), other.id()};
+  }
+  return merges > 0;
+}
+
+// Coarsens the problem until it is small enough, solves the coarsest level then
+// refines level by level, the routes of a level being the initial solution of the
+// next finer one.
+int MultilevelSolver(const ortools_vrp::Problem& problem, std::string filename) {
+  std::vector<ortools_vrp::Problem> levels(1, problem);
+  std::vector<std::map<std::string, std::vector<std::string>>> children(1);
+  // Initial routes provided would be overridden by the projected ones
+  while (problem.routes_size() == 0 &&
+         levels.back().services_size() > FLAGS_multilevel_coarsest_size) {
+    ortools_vrp::Problem coarse_problem;
+    std::map<std::string, std::vector<std::string>> level_children;
+    if (!CoarsenProblem(levels.back(), levels.size(), &coarse_problem, &level_children))
+      break;
+    levels.push_back(coarse_problem);
+    children.push_back(level_children);
+  }
+
+  // The finest level gets twice the time of the coarser ones
+  const int64 level_time_limit = FLAGS_time_limit_in_ms / (levels.size() + 1);
+  const double start_time      = absl::GetCurrentTimeNanos();
+  for (int level = levels.size() - 1; level > 0; --level) {
+    ortools_result::Result level_result;
+    {
+      TSPTWDataDT data(levels[level]);
+      TSPTWSolver(data, "", &level_result, level_time_limit);
+    }
+    std::cout << "Multilevel level : " << level
+              << " Services : " << levels[level].services_size()
+              << " Cost : " << level_result.cost()
+              << " Time : " << 1e-9 * (absl::GetCurrentTimeNanos() - start_time)
+              << std::endl;
+
+    ortools_vrp::Problem& finer_problem = levels[level - 1];
+    finer_problem.clear_routes();
+    for (int v = 0; v < level_result.routes_size() && v < finer_problem.vehicles_size();
+         ++v) {
+      ortools_vrp::Route route;
+      route.set_vehicle_id(finer_problem.vehicles(v).id());
+      for (const ortools_result::Activity& activity : level_result.routes(v).activities()) {
+        if (activity.type() != "service")
+          continue;
+        if (children[level].count(activity.id())) {
+          for (const std::string& child_id : children[level].at(activity.id()))
+            route.add_service_ids(child_id);
+        } else {
+          route.add_service_ids(activity.id());
+        }
+      }
+      // Vehicles given a route are kept out of the fleet reduction
+      if (route.service_ids_size() > 0)
+        finer_problem.add_routes()->Swap(&route);
+    }
+  }
+
+  TSPTWDataDT data(levels[0]);
+  return TSPTWSolver(data, filename, NULL,
+                     FLAGS_time_limit_in_ms - level_time_limit * (levels.size() - 1));
+}
+
 } // namespace operations_research
 
 int main(int argc, char** argv) {
@@ -1316,8 +1867,20 @@ int main(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
 
   if (FLAGS_time_limit_in_ms > 0 || FLAGS_no_solution_improvement_limit > 0) {
-    operations_research::TSPTWDataDT tsptw_data(FLAGS_instance_file);
-    return operations_research::TSPTWSolver(tsptw_data, FLAGS_solution_file);
+    int status = 0;
+    if (FLAGS_multilevel) {
+      ortools_vrp::Problem problem;
+      std::fstream input(FLAGS_instance_file, std::ios::in | std::ios::binary);
+      if (!problem.ParseFromIstream(&input)) {
+        VLOG(0) << "Failed to parse pbf." << std::endl;
+      }
+      status = operations_research::MultilevelSolver(problem, FLAGS_solution_file);
+    } else {
+      operations_research::TSPTWDataDT tsptw_data(FLAGS_instance_file);
+      status = operations_research::TSPTWSolver(tsptw_data, FLAGS_solution_file);
+    }
+    google::protobuf::ShutdownProtobufLibrary();
+    return status;
   } else {
     std::cout << "No stopping condition" << std::endl;
     return -1;
@@ -4,6 +4,7 @@
 #include <cmath>
 #include <iomanip>
 #include <ostream>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -19,6 +20,22 @@
 
 #define CUSTOM_BIGNUM 1000000.0
 
+DEFINE_bool(presolve_infeasible_services, true,
+            "Remove services no vehicle can serve before building the model");
+DEFINE_bool(aggregate_services, false,
+            "Merge services sharing a location and constraints into a single node");
+DEFINE_int64(vehicle_limit, 0, "Define the maximum number of vehicle");
+DEFINE_bool(reduce_fleet, true,
+            "Remove identical vehicles beyond the number that could be used");
+DEFINE_double(fleet_reduction_ratio, 0,
+              "When positive, also keep at most this ratio of the identical vehicles "
+              "needed by demand over capacity and service time over shift length");
+DEFINE_bool(matrix_reordering, false,
+            "Renumber matrix points along a nearest neighbour chain for memory locality");
+DEFINE_bool(soft_time_windows_union, false,
+            "Keep a single node for a service with several soft time windows, its "
+            "lateness being penalized over the union of its windows");
+
 enum RelationType {
   NeverLast            = 13,
   VehicleTrips         = 12,
@@ -43,6 +60,8 @@ class TSPTWDataDT {
 public:
   explicit TSPTWDataDT(std::string filename) { LoadInstance(filename); }
 
+  explicit TSPTWDataDT(ortools_vrp::Problem problem) { LoadPresolvedProblem(&problem); }
+
   ~TSPTWDataDT() {
     for (auto i : tsptw_vehicles_)
       delete i;
@@ -59,11 +78,25 @@ public:
     for (auto i : values_matrices_)
       delete i;
 
+    for (auto i : sparse_distances_matrices_)
+      delete i;
+
+    for (auto i : sparse_times_matrices_)
+      delete i;
+
+    for (auto i : sparse_values_matrices_)
+      delete i;
+
     for (auto i : tsptw_routes_)
       delete i;
   }
   void LoadInstance(const std::string& filename);
 
+  void LoadProblem(const ortools_vrp::Problem& problem);
+
+  //  Reduces the fleet of the problem when enabled, then loads it
+  void LoadPresolvedProblem(ortools_vrp::Problem* problem);
+
   //  Helper function
   int64& SetMatrix(int i, int j) {
     return distances_matrices_.back()->Cost(RoutingIndexManager::NodeIndex(i),
@@ -80,54 +113,72 @@ public:
                                          RoutingIndexManager::NodeIndex(j));
   }
 
-  int64 BuildTimeMatrix(ortools_vrp::Matrix matrix) {
-    int64 max_time    = 0;
+  void BuildTimeMatrix(const ortools_vrp::Matrix& matrix) {
     int32 size_matrix = sqrt(matrix.time_size());
-    for (int64 i = 0; i < size_matrix; ++i) {
-      for (int64 j = 0; j < size_matrix; ++j) {
-        if (static_cast<int64>(matrix.time(i * size_matrix + j)) < CUSTOM_MAX_INT)
-          max_time = std::max(max_time,
-                              static_cast<int64>(matrix.time(i * size_matrix + j) + 0.5));
-        // std::cout << matrix.time(i * size_matrix + j) << "->" <<
-        // static_cast<int64>(matrix.time(i * size_matrix + j) + 0.5) << "\t | \t";
-        SetTimeMatrix(i, j) = static_cast<int64>(matrix.time(i * size_matrix + j) + 0.5);
+    for (std::size_t i = 0; i < matrix_points_.size(); ++i) {
+      if (matrix_points_[i] >= size_matrix)
+        continue;
+      for (std::size_t j = 0; j < matrix_points_.size(); ++j) {
+        if (matrix_points_[j] >= size_matrix)
+          continue;
+        SetTimeMatrix(i, j) = static_cast<int64>(
+            matrix.time(matrix_points_[i] * size_matrix + matrix_points_[j]) + 0.5);
       }
-      // std::cout << std::endl;
     }
-
-    return max_time;
   }
 
-  int64 BuildDistanceMatrix(ortools_vrp::Matrix matrix) {
-    int64 max_distance = 0;
-    int32 size_matrix  = sqrt(matrix.distance_size());
-    for (int64 i = 0; i < size_matrix; ++i) {
-      for (int64 j = 0; j < size_matrix; ++j) {
-        if (static_cast<int64>(matrix.distance(i * size_matrix + j)) < CUSTOM_MAX_INT)
-          max_distance = std::max(
-              max_distance, static_cast<int64>(matrix.distance(i * size_matrix + j)));
-        SetMatrix(i, j) = static_cast<int64>(matrix.distance(i * size_matrix + j));
+  void BuildDistanceMatrix(const ortools_vrp::Matrix& matrix) {
+    int32 size_matrix = sqrt(matrix.distance_size());
+    for (std::size_t i = 0; i < matrix_points_.size(); ++i) {
+      if (matrix_points_[i] >= size_matrix)
+        continue;
+      for (std::size_t j = 0; j < matrix_points_.size(); ++j) {
+        if (matrix_points_[j] >= size_matrix)
+          continue;
+        SetMatrix(i, j) = static_cast<int64>(
+            matrix.distance(matrix_points_[i] * size_matrix + matrix_points_[j]));
       }
     }
-    return max_distance;
   }
 
-  int64 BuildValueMatrix(ortools_vrp::Matrix matrix) {
-    int64 max_value   = 0;
+  void BuildValueMatrix(const ortools_vrp::Matrix& matrix) {
     int32 size_matrix = sqrt(matrix.value_size());
-    for (int64 i = 0; i < size_matrix; ++i) {
-      for (int64 j = 0; j < size_matrix; ++j) {
-        if (static_cast<int64>(matrix.value(i * size_matrix + j)) < CUSTOM_MAX_INT)
-          max_value =
-              std::max(max_value, static_cast<int64>(matrix.value(i * size_matrix + j)));
-        SetValueMatrix(i, j) = static_cast<int64>(matrix.value(i * size_matrix + j));
+    for (std::size_t i = 0; i < matrix_points_.size(); ++i) {
+      if (matrix_points_[i] >= size_matrix)
+        continue;
+      for (std::size_t j = 0; j < matrix_points_.size(); ++j) {
+        if (matrix_points_[j] >= size_matrix)
+          continue;
+        SetValueMatrix(i, j) = static_cast<int64>(
+            matrix.value(matrix_points_[i] * size_matrix + matrix_points_[j]));
       }
     }
-    return max_value;
   }
 
   int64 Horizon() const { return horizon_; }
 
+  int32 SizeProblemVehicles() const {
+    return tsptw_vehicles_.size() + removed_vehicles_.size();
+  }
+
+  int32 VehiclePosition(int32 v) const {
+    return vehicle_positions_.empty() ? v : vehicle_positions_[v];
+  }
+
+  const std::map<int32, int64>& RemovedVehicles() const { return removed_vehicles_; }
+
+  bool IsSparse() const {
+    for (const SparseGraphArcCost* matrix : sparse_times_matrices_) {
+      if (matrix != nullptr)
+        return true;
+    }
+    return false;
+  }
+
+  // Mission nodes located at a stored neighbour of the node in a sparse matrix
+  std::vector<RoutingIndexManager::NodeIndex>
+  SparseNeighbours(RoutingIndexManager::NodeIndex node) const;
+
   int64 MatrixIndex(RoutingIndexManager::NodeIndex i) const {
     return tsptw_clients_[i.value()].matrix_index;
   }
@@ -150,10 +201,18 @@ public:
 
   int64 TwiceTWsCounter() const { return multiple_tws_counter_; }
 
+  //  Alternative nodes saved by counting lateness over the union of windows
+  int64 MergedTimeWindowsCounter() const { return merged_tws_counter_; }
+
   int64 OrderCounter() const { return order_counter_; }
 
   int64 DeliveriesCounter() const { return deliveries_counter_; }
 
+  //  Services removed by the presolve, no compatible vehicle can serve them
+  std::vector<std::string> InfeasibleServiceIds() const {
+    return infeasible_service_ids_;
+  }
+
   int64 IdIndex(std::string id) const {
     std::map<std::string, int64>::const_iterator it = ids_map_.find(id);
     if (it != ids_map_.end())
@@ -171,12 +230,15 @@ public:
   }
 
   int64 DayIndexToVehicleIndex(int64 day_index) const {
-    if (day_index_to_vehicle_index_.count(day_index)) {
-      return day_index_to_vehicle_index_.at(day_index);
+    if (day_index >= 0 && day_index < static_cast<int64>(day_first_vehicles_.size())) {
+      return day_first_vehicles_[day_index];
     }
     return CUSTOM_MAX_INT;
   }
 
+  //  First vehicle index of each day, vehicles being sorted by day
+  const std::vector<int64>& DayFirstVehicles() const { return day_first_vehicles_; }
+
   int32 AlternativeSize(int32 problem_index) const {
     if (alternative_size_map_.count(problem_index))
       return alternative_size_map_.at(problem_index);
@@ -195,6 +257,41 @@ public:
     return tsptw_clients_[i.value()].alternative_index;
   }
 
+  //  Whether the node carries several soft time windows, its lateness being
+  //  counted from the closest window opened before its start
+  bool SoftTimeWindowsUnion(RoutingIndexManager::NodeIndex i) const {
+    return tsptw_clients_[i.value()].late_multiplier > 0 &&
+           tsptw_clients_[i.value()].ready_time.size() > 1;
+  }
+
+  //  Lateness over the union of the soft time windows of the node, from its
+  //  earliest start within [min, max], with the input index of the window it
+  //  is counted from. The lateness is kint64max when no window opens by max.
+  std::pair<int64, int32> UnionLateness(RoutingIndexManager::NodeIndex i, int64 min,
+                                        int64 max) const {
+    const TSPTWClient& client = tsptw_clients_[i.value()];
+    std::pair<int64, int32> best(kint64max, 0);
+    for (std::size_t tw = 0; tw < client.ready_time.size(); ++tw) {
+      if (client.ready_time[tw] > max)
+        continue;
+      const int64 lateness = client.due_time[tw] < CUSTOM_MAX_INT
+                                 ? std::max<int64>(std::max(min, client.ready_time[tw]) -
+                                                       client.due_time[tw],
+                                                   0)
+                                 : 0;
+      if (lateness < best.first)
+        best = std::make_pair(lateness, static_cast<int32>(tw));
+    }
+    return best;
+  }
+
+  //  Input index of the time window the start is counted in, the alternative
+  //  index otherwise
+  int32 ServedAlternativeIndex(RoutingIndexManager::NodeIndex i, int64 start) const {
+    return SoftTimeWindowsUnion(i) ? UnionLateness(i, start, start).second
+                                   : AlternativeIndex(i);
+  }
+
   std::vector<int64> ReadyTime(RoutingIndexManager::NodeIndex i) const {
     return tsptw_clients_[i.value()].ready_time;
   }
@@ -256,9 +353,7 @@ public:
     int64 index = from.value();
     if (unit_i < tsptw_clients_.at(index).quantities.size()) {
       if (tsptw_vehicles_[0]->counting.at(unit_i)) {
-        if (tsptw_vehicles_[0]->stop == to ||
-            tsptw_vehicles_[0]->Distance(from, to) > 0 ||
-            tsptw_vehicles_[0]->Time(from, to) > 0)
+        if (LeavesLocation(from, to))
           return tsptw_clients_.at(index).quantities.at(unit_i) -
                  tsptw_clients_.at(index).setup_quantities.at(unit_i);
         else
@@ -270,10 +365,36 @@ public:
     }
   }
 
+  //  Counting units subtract their setup quantity when the vehicle moves on
+  bool LeavesLocation(RoutingIndexManager::NodeIndex from,
+                      RoutingIndexManager::NodeIndex to) const {
+    return tsptw_vehicles_[0]->stop == to || tsptw_vehicles_[0]->Distance(from, to) > 0 ||
+           tsptw_vehicles_[0]->Time(from, to) > 0;
+  }
+
   std::vector<int64> Quantities(RoutingIndexManager::NodeIndex i) const {
     return tsptw_clients_[i.value()].quantities;
   }
 
+  const std::vector<int64>& SetupQuantities(RoutingIndexManager::NodeIndex i) const {
+    return tsptw_clients_[i.value()].setup_quantities;
+  }
+
+  //  Services merged into a node, sorted by duration. Empty for a single service
+  struct AggregatedService {
+    AggregatedService(std::string s_id, int32 p_i, int64 s_t, std::vector<int64> q)
+        : service_id(s_id), problem_index(p_i), service_time(s_t), quantities(q) {}
+    std::string service_id;
+    int32 problem_index;
+    int64 service_time;
+    std::vector<int64> quantities;
+  };
+
+  const std::vector<AggregatedService>&
+  AggregatedServices(RoutingIndexManager::NodeIndex i) const {
+    return tsptw_clients_[i.value()].aggregated_services;
+  }
+
   struct Rest {
     Rest(std::string id, std::vector<int64> r_t, std::vector<int64> d_t, int64 s_t)
         : rest_id(id), ready_time(r_t), due_time(d_t), service_time(s_t) {}
@@ -289,7 +410,9 @@ public:
         , size(size_)
         , problem_matrix_index(0)
         , value_matrix_index(0)
-        , vehicle_indices(0)
+        , start_matrix_index(-1)
+        , end_matrix_index(-1)
+        , symmetry_class(-1)
         , capacity(0)
         , overload_multiplier(0)
         , break_size(0)
@@ -316,110 +439,107 @@ public:
       return 0;
     }
 
+    //  Sparse matrices replace the full ones of the same index
+    static int64 ArcCost(const std::vector<CompleteGraphArcCost*>& matrices,
+                         const std::vector<SparseGraphArcCost*>& sparse_matrices,
+                         int64 matrix_index, int32 from, int32 to) {
+      const SparseGraphArcCost* sparse = sparse_matrices.at(matrix_index);
+      if (sparse != nullptr)
+        return sparse->Cost(RoutingIndexManager::NodeIndex(from),
+                            RoutingIndexManager::NodeIndex(to));
+      return matrices[matrix_index]->Cost(RoutingIndexManager::NodeIndex(from),
+                                          RoutingIndexManager::NodeIndex(to));
+    }
+
+    //  Matrix point of a node, -1 when the node has no location
+    int32 MatrixPoint(RoutingIndexManager::NodeIndex i) const {
+      if (i == start)
+        return start_matrix_index;
+      if (i == stop)
+        return end_matrix_index;
+      return data->matrix_indices_[i.value()];
+    }
+
     int64 Distance(RoutingIndexManager::NodeIndex i,
                    RoutingIndexManager::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1)
+      const int32 from = MatrixPoint(i);
+      const int32 to   = MatrixPoint(j);
+      if (from == -1 || to == -1)
         return 0;
+      const int64 distance =
+          ArcCost(data->distances_matrices_, data->sparse_distances_matrices_,
+                  problem_matrix_index, from, to);
       if (i != Start() && j != Stop() && max_ride_distance_ > 0 &&
-          data->distances_matrices_.at(problem_matrix_index)
-                  ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                         RoutingIndexManager::NodeIndex(vehicle_indices[j.value()])) >
-              max_ride_distance_)
+          distance > max_ride_distance_)
         return CUSTOM_MAX_INT;
-      return data->distances_matrices_.at(problem_matrix_index)
-          ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                 RoutingIndexManager::NodeIndex(vehicle_indices[j.value()]));
+      return distance;
     }
 
     int64 FakeDistance(RoutingIndexManager::NodeIndex i,
                        RoutingIndexManager::NodeIndex j) const {
-      CheckNodeIsValid(i);
-      CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1 ||
-          (i == Start() && free_approach) || (j == Stop() && free_return))
+      if ((i == Start() && free_approach) || (j == Stop() && free_return))
         return 0;
-      if (i != Start() && j != Stop() && max_ride_distance_ > 0 &&
-          data->distances_matrices_.at(problem_matrix_index)
-                  ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                         RoutingIndexManager::NodeIndex(vehicle_indices[j.value()])) >
-              max_ride_distance_)
-        return CUSTOM_MAX_INT;
-      return data->distances_matrices_.at(problem_matrix_index)
-          ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                 RoutingIndexManager::NodeIndex(vehicle_indices[j.value()]));
+      return Distance(i, j);
     }
 
     int64 Time(RoutingIndexManager::NodeIndex i, RoutingIndexManager::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1)
+      const int32 from = MatrixPoint(i);
+      const int32 to   = MatrixPoint(j);
+      if (from == -1 || to == -1)
         return 0;
-      if (i != Start() && j != Stop() && max_ride_time_ > 0 &&
-          data->times_matrices_.at(problem_matrix_index)
-                  ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                         RoutingIndexManager::NodeIndex(vehicle_indices[j.value()])) >
-              max_ride_time_)
+      const int64 time = ArcCost(data->times_matrices_, data->sparse_times_matrices_,
+                                 problem_matrix_index, from, to);
+      if (i != Start() && j != Stop() && max_ride_time_ > 0 && time > max_ride_time_)
         return CUSTOM_MAX_INT;
-      return data->times_matrices_.at(problem_matrix_index)
-          ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                 RoutingIndexManager::NodeIndex(vehicle_indices[j.value()]));
+      return time;
     }
 
     int64 FakeTime(RoutingIndexManager::NodeIndex i,
                    RoutingIndexManager::NodeIndex j) const {
-      CheckNodeIsValid(i);
-      CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1 ||
-          (i == Start() && free_approach) || (j == Stop() && free_return))
+      if ((i == Start() && free_approach) || (j == Stop() && free_return))
         return 0;
-      if (i != Start() && j != Stop() && max_ride_time_ > 0 &&
-          data->times_matrices_.at(problem_matrix_index)
-                  ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                         RoutingIndexManager::NodeIndex(vehicle_indices[j.value()])) >
-              max_ride_time_)
-        return CUSTOM_MAX_INT;
-      return data->times_matrices_.at(problem_matrix_index)
-          ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                 RoutingIndexManager::NodeIndex(vehicle_indices[j.value()]));
+      return Time(i, j);
     }
 
     int64 Value(RoutingIndexManager::NodeIndex i,
                 RoutingIndexManager::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1)
+      const int32 from = MatrixPoint(i);
+      const int32 to   = MatrixPoint(j);
+      if (from == -1 || to == -1)
         return 0;
-      return data->values_matrices_.at(value_matrix_index)
-          ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                 RoutingIndexManager::NodeIndex(vehicle_indices[j.value()]));
+      return ArcCost(data->values_matrices_, data->sparse_values_matrices_,
+                     value_matrix_index, from, to);
     }
 
     int64 TimeOrder(RoutingIndexManager::NodeIndex i,
                     RoutingIndexManager::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1)
+      const int32 from = MatrixPoint(i);
+      const int32 to   = MatrixPoint(j);
+      if (from == -1 || to == -1)
         return 0;
-      return 10 *
-             std::sqrt(
-                 data->times_matrices_.at(problem_matrix_index)
-                     ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                            RoutingIndexManager::NodeIndex(vehicle_indices[j.value()])));
+      return 10 * std::sqrt(ArcCost(data->times_matrices_, data->sparse_times_matrices_,
+                                    problem_matrix_index, from, to));
     }
 
     int64 DistanceOrder(RoutingIndexManager::NodeIndex i,
                         RoutingIndexManager::NodeIndex j) const {
       CheckNodeIsValid(i);
       CheckNodeIsValid(j);
-      if (vehicle_indices[i.value()] == -1 || vehicle_indices[j.value()] == -1)
+      const int32 from = MatrixPoint(i);
+      const int32 to   = MatrixPoint(j);
+      if (from == -1 || to == -1)
         return 0;
-      return 100 *
-             std::sqrt(
-                 data->distances_matrices_.at(problem_matrix_index)
-                     ->Cost(RoutingIndexManager::NodeIndex(vehicle_indices[i.value()]),
-                            RoutingIndexManager::NodeIndex(vehicle_indices[j.value()])));
+      return 100 * std::sqrt(ArcCost(data->distances_matrices_,
+                                     data->sparse_distances_matrices_,
+                                     problem_matrix_index, from, to));
     }
 
     //  Transit quantity at a node "from"
@@ -491,7 +611,10 @@ public:
     RoutingIndexManager::NodeIndex stop;
     int64 problem_matrix_index;
     int64 value_matrix_index;
-    std::vector<int64> vehicle_indices;
+    int32 start_matrix_index;
+    int32 end_matrix_index;
+    // Interchangeable vehicles share a class, -1 when the vehicle is unique
+    int32 symmetry_class;
     std::vector<int64> capacity;
     std::vector<bool> counting;
     std::vector<int64> overload_multiplier;
@@ -567,7 +690,7 @@ public:
 
   std::vector<Relation*> Relations() const { return tsptw_relations_; }
 
-  std::vector<int> VehiclesDay() const { return vehicles_day_; }
+  const std::vector<int>& VehiclesDay() const { return vehicles_day_; }
 
   int VehicleDay(int64 index) const {
     if (index < 0) {
@@ -591,6 +714,32 @@ public:
 private:
   void ProcessNewLine(char* const line);
 
+  std::set<std::string> InfeasibleServices(const ortools_vrp::Problem& problem) const;
+
+  bool VehicleCanServe(const ortools_vrp::Problem& problem,
+                       const ortools_vrp::Vehicle& vehicle,
+                       const ortools_vrp::Service& service) const;
+
+  std::map<std::string, std::vector<const ortools_vrp::Service*>>
+  AggregateServices(const ortools_vrp::Problem& problem,
+                    const std::set<std::string>& infeasible_ids) const;
+
+  void CompactMatrixPoints(const ortools_vrp::Problem& problem);
+
+  int64 CompactMatrixIndex(int64 index) const;
+
+  void ReorderMatrices();
+
+  void LoadSparseMatrix(const ortools_vrp::Problem& problem,
+                        const ortools_vrp::Matrix& matrix);
+
+  std::vector<std::string> VehicleFingerprints(const ortools_vrp::Problem& problem) const;
+
+  void ReduceFleet(ortools_vrp::Problem* problem);
+
+  int32 UsefulVehicles(const ortools_vrp::Problem& problem, int32 vehicle_index,
+                       int32 class_size) const;
+
   struct TSPTWClient {
     // Depot definition
     TSPTWClient(std::string cust_id, int32 m_i, int32 p_i)
@@ -645,6 +794,7 @@ private:
     std::vector<int64> setup_quantities;
     int64 exclusion_cost;
     std::vector<bool> refill_quantities;
+    std::vector<AggregatedService> aggregated_services;
     bool is_break;
   };
 
@@ -662,6 +812,15 @@ private:
   std::vector<CompleteGraphArcCost*> distances_matrices_;
   std::vector<CompleteGraphArcCost*> times_matrices_;
   std::vector<CompleteGraphArcCost*> values_matrices_;
+  // Not null for the matrices given in sparse mode, the full ones are null then
+  std::vector<SparseGraphArcCost*> sparse_distances_matrices_;
+  std::vector<SparseGraphArcCost*> sparse_times_matrices_;
+  std::vector<SparseGraphArcCost*> sparse_values_matrices_;
+  // Problem position of each vehicle and start time of the removed ones
+  std::vector<int32> vehicle_positions_;
+  std::map<int32, int64> removed_vehicles_;
+  // Mission nodes at each matrix point, in sparse mode only
+  std::vector<std::vector<int32>> point_nodes_;
   std::vector<int> vehicles_day_;
   std::vector<int64> service_times_;
   std::string details_;
@@ -678,11 +837,528 @@ private:
   int64 order_counter_;
   int64 deliveries_counter_;
   int64 multiple_tws_counter_;
+  int64 merged_tws_counter_;
   std::map<std::string, int64> ids_map_;
   std::map<std::string, int64> vehicle_ids_map_;
-  std::map<int64, int64> day_index_to_vehicle_index_;
+  std::vector<int64> day_first_vehicles_;
+  std::vector<std::string> infeasible_service_ids_;
+  // Upstream matrix point of each compacted matrix row, sorted
+  std::vector<int32> matrix_points_;
+  // Matrix point of each mission node, shared by all vehicles
+  std::vector<int32> matrix_indices_;
 };
 
+namespace {
+// Matrix lookup on the raw problem, rounded as in BuildTimeMatrix
+int64 ProblemMatrixCost(const google::protobuf::RepeatedField<float>& costs, int32 from,
+                        int32 to) {
+  const int32 size_matrix = sqrt(costs.size());
+  if (from < 0 || to < 0 || from >= size_matrix || to >= size_matrix)
+    return 0;
+  return static_cast<int64>(costs.Get(from * size_matrix + to) + 0.5);
+}
+} // namespace
+
+bool TSPTWDataDT::VehicleCanServe(const ortools_vrp::Problem& problem,
+                                  const ortools_vrp::Vehicle& vehicle,
+                                  const ortools_vrp::Service& service) const {
+  // Quantities above a hard capacity can never be loaded, even with refills
+  for (int unit_i = 0;
+       unit_i < std::min(service.quantities_size(), vehicle.capacities_size()); ++unit_i) {
+    const ortools_vrp::Capacity& capacity = vehicle.capacities(unit_i);
+    if (capacity.limit() >= 0 && capacity.overload_multiplier() == 0 &&
+        !capacity.counting() && std::abs(service.quantities(unit_i)) > capacity.limit())
+      return false;
+  }
+
+  if (vehicle.matrix_index() >= (uint32)problem.matrices_size())
+    return true;
+  const ortools_vrp::Matrix& matrix = problem.matrices(vehicle.matrix_index());
+  const int32 service_index         = service.matrix_index();
+
+  const int64 approach_time =
+      ProblemMatrixCost(matrix.time(), vehicle.start_index(), service_index);
+  const int64 return_time =
+      ProblemMatrixCost(matrix.time(), service_index, vehicle.end_index());
+  const int64 approach_distance =
+      ProblemMatrixCost(matrix.distance(), vehicle.start_index(), service_index);
+  const int64 return_distance =
+      ProblemMatrixCost(matrix.distance(), service_index, vehicle.end_index());
+  if (approach_time >= CUSTOM_MAX_INT || return_time >= CUSTOM_MAX_INT ||
+      approach_distance >= CUSTOM_MAX_INT || return_distance >= CUSTOM_MAX_INT)
+    return false;
+  if (vehicle.distance() > 0 && approach_distance + return_distance > vehicle.distance())
+    return false;
+
+  const int64 time_start = vehicle.time_window().start() > -CUSTOM_MAX_INT
+                               ? vehicle.time_window().start()
+                               : -CUSTOM_MAX_INT;
+  const int64 time_end =
+      vehicle.time_window().end() < CUSTOM_MAX_INT ? vehicle.time_window().end()
+                                                   : CUSTOM_MAX_INT;
+  const int64 service_time =
+      vehicle.coef_service() * service.duration() + vehicle.additional_service();
+
+  // Earliest start of the service, within one of its time windows
+  int64 earliest_start = time_start + approach_time;
+  if (service.time_windows_size() > 0) {
+    int64 best_start = CUSTOM_MAX_INT;
+    for (const ortools_vrp::TimeWindow& timewindow : service.time_windows()) {
+      if (service.late_multiplier() > 0 || timewindow.end() >= CUSTOM_MAX_INT ||
+          timewindow.end() >= earliest_start)
+        best_start = std::min(best_start, std::max(earliest_start, timewindow.start()));
+    }
+    if (best_start >= CUSTOM_MAX_INT)
+      return false;
+    earliest_start = best_start;
+  }
+
+  if (vehicle.cost_late_multiplier() == 0 && time_end < CUSTOM_MAX_INT &&
+      earliest_start + service_time + return_time > time_end)
+    return false;
+
+  if (vehicle.duration() >= 0 && time_end - time_start > vehicle.duration() &&
+      approach_time + service_time + return_time > vehicle.duration())
+    return false;
+
+  return true;
+}
+
+namespace {
+bool CanAggregate(const ortools_vrp::Service& head, const ortools_vrp::Service& service) {
+  if (head.matrix_index() != service.matrix_index() ||
+      head.priority() != service.priority() ||
+      head.exclusion_cost() != service.exclusion_cost() ||
+      head.setup_duration() != service.setup_duration() ||
+      head.time_windows_size() != service.time_windows_size() ||
+      head.vehicle_indices_size() != service.vehicle_indices_size() ||
+      head.quantities_size() != service.quantities_size())
+    return false;
+  for (int tw = 0; tw < head.time_windows_size(); ++tw) {
+    if (head.time_windows(tw).start() != service.time_windows(tw).start() ||
+        head.time_windows(tw).end() != service.time_windows(tw).end())
+      return false;
+  }
+  std::vector<int32> head_vehicles(head.vehicle_indices().begin(),
+                                   head.vehicle_indices().end());
+  std::vector<int32> vehicles(service.vehicle_indices().begin(),
+                              service.vehicle_indices().end());
+  std::sort(head_vehicles.begin(), head_vehicles.end());
+  std::sort(vehicles.begin(), vehicles.end());
+  if (head_vehicles != vehicles)
+    return false;
+  // Pickups and deliveries are not mixed, the summed load stays a valid bound
+  for (int unit_i = 0; unit_i < head.quantities_size(); ++unit_i) {
+    if ((head.quantities(unit_i) < 0 && service.quantities(unit_i) > 0) ||
+        (head.quantities(unit_i) > 0 && service.quantities(unit_i) < 0))
+      return false;
+  }
+  return true;
+}
+
+// The longest service is performed last, each service still starts before the due
+int64 AggregatedDueShift(const std::vector<const ortools_vrp::Service*>& services,
+                         float max_coef_service) {
+  int64 total_duration = 0;
+  int64 max_duration   = 0;
+  for (const ortools_vrp::Service* service : services) {
+    total_duration += service->duration();
+    max_duration = std::max(max_duration, (int64)service->duration());
+  }
+  return std::ceil(max_coef_service * (total_duration - max_duration));
+}
+} // namespace
+
+std::map<std::string, std::vector<const ortools_vrp::Service*>>
+TSPTWDataDT::AggregateServices(const ortools_vrp::Problem& problem,
+                               const std::set<std::string>& infeasible_ids) const {
+  std::map<std::string, std::vector<const ortools_vrp::Service*>> aggregations;
+
+  // Per service costs and counting units can't be carried by a single node
+  float max_coef_service = 0;
+  for (const ortools_vrp::Vehicle& vehicle : problem.vehicles()) {
+    if (vehicle.additional_service() != 0)
+      return aggregations;
+    for (const ortools_vrp::Capacity& capacity : vehicle.capacities()) {
+      if (capacity.counting())
+        return aggregations;
+    }
+    max_coef_service = std::max(max_coef_service, vehicle.coef_service());
+  }
+
+  // Relations and initial routes refer to the individual services
+  std::set<std::string> excluded_ids(infeasible_ids);
+  for (const ortools_vrp::Relation& relation : problem.relations()) {
+    for (const std::string& linked_id : relation.linked_ids())
+      excluded_ids.insert(linked_id);
+  }
+  for (const ortools_vrp::Route& route : problem.routes()) {
+    for (const std::string& service_id : route.service_ids())
+      excluded_ids.insert(service_id);
+  }
+  std::map<int32, int32> problem_index_count;
+  for (const ortools_vrp::Service& service : problem.services())
+    ++problem_index_count[service.problem_index()];
+
+  std::map<uint32, std::vector<const ortools_vrp::Service*>> locations;
+  for (const ortools_vrp::Service& service : problem.services()) {
+    bool refill = false;
+    for (const bool refill_quantity : service.refill_quantities())
+      refill |= refill_quantity;
+    if (!excluded_ids.count(service.id()) &&
+        problem_index_count[service.problem_index()] == 1 &&
+        service.late_multiplier() == 0 && service.time_windows_size() <= 1 && !refill)
+      locations[service.matrix_index()].push_back(&service);
+  }
+
+  for (const auto& location : locations) {
+    if (location.second.size() < 2)
+      continue;
+    bool zero_transit = true;
+    for (const ortools_vrp::Matrix& matrix : problem.matrices()) {
+      zero_transit &=
+          ProblemMatrixCost(matrix.time(), location.first, location.first) == 0 &&
+          ProblemMatrixCost(matrix.distance(), location.first, location.first) == 0;
+    }
+    if (!zero_transit)
+      continue;
+
+    std::vector<std::vector<const ortools_vrp::Service*>> clusters;
+    for (const ortools_vrp::Service* service : location.second) {
+      bool aggregated = false;
+      for (std::vector<const ortools_vrp::Service*>& cluster : clusters) {
+        if (!CanAggregate(*cluster.front(), *service))
+          continue;
+        cluster.push_back(service);
+        const ortools_vrp::Service& head = *cluster.front();
+        if (head.time_windows_size() == 0 ||
+            head.time_windows(0).end() >= CUSTOM_MAX_INT ||
+            head.time_windows(0).end() - AggregatedDueShift(cluster, max_coef_service) >=
+                std::max(head.time_windows(0).start(), -CUSTOM_MAX_INT)) {
+          aggregated = true;
+          break;
+        }
+        cluster.pop_back();
+      }
+      if (!aggregated)
+        clusters.push_back({service});
+    }
+
+    for (std::vector<const ortools_vrp::Service*>& cluster : clusters) {
+      if (cluster.size() < 2)
+        continue;
+      const std::string head_id = cluster.front()->id();
+      std::stable_sort(cluster.begin(), cluster.end(),
+                       [](const ortools_vrp::Service* a, const ortools_vrp::Service* b) {
+                         return a->duration() < b->duration();
+                       });
+      aggregations[head_id] = cluster;
+    }
+  }
+  return aggregations;
+}
+
+std::set<std::string>
+TSPTWDataDT::InfeasibleServices(const ortools_vrp::Problem& problem) const {
+  std::set<std::string> infeasible_ids;
+  if (problem.vehicles_size() == 0)
+    return infeasible_ids;
+
+  // Services linked by a relation are kept, the relation builders expect them
+  std::set<std::string> related_ids;
+  for (const ortools_vrp::Relation& relation : problem.relations()) {
+    for (const std::string& linked_id : relation.linked_ids())
+      related_ids.insert(linked_id);
+  }
+
+  // Alternatives share a problem index, they are removed together or not at all
+  std::map<int32, bool> feasible_problem_indices;
+  for (const ortools_vrp::Service& service : problem.services()) {
+    bool feasible = related_ids.count(service.id()) > 0;
+    if (!feasible && service.vehicle_indices_size() > 0) {
+      for (const int32 v : service.vehicle_indices()) {
+        if (v >= 0 && v < problem.vehicles_size() &&
+            VehicleCanServe(problem, problem.vehicles(v), service)) {
+          feasible = true;
+          break;
+        }
+      }
+    } else if (!feasible) {
+      for (const ortools_vrp::Vehicle& vehicle : problem.vehicles()) {
+        if (VehicleCanServe(problem, vehicle, service)) {
+          feasible = true;
+          break;
+        }
+      }
+    }
+    feasible_problem_indices[service.problem_index()] |= feasible;
+  }
+
+  for (const ortools_vrp::Service& service : problem.services()) {
+    if (!feasible_problem_indices[service.problem_index()])
+      infeasible_ids.insert(service.id());
+  }
+  return infeasible_ids;
+}
+
+// Matrices are built over the points referenced by a service or a vehicle only,
+// whatever the size of the upstream matrices
+void TSPTWDataDT::CompactMatrixPoints(const ortools_vrp::Problem& problem) {
+  matrix_points_.clear();
+  for (const ortools_vrp::Service& service : problem.services()) {
+    matrix_points_.push_back(service.matrix_index());
+  }
+  for (const ortools_vrp::Vehicle& vehicle : problem.vehicles()) {
+    if (vehicle.start_index() >= 0)
+      matrix_points_.push_back(vehicle.start_index());
+    if (vehicle.end_index() >= 0)
+      matrix_points_.push_back(vehicle.end_index());
+  }
+  std::sort(matrix_points_.begin(), matrix_points_.end());
+  matrix_points_.erase(std::unique(matrix_points_.begin(), matrix_points_.end()),
+                       matrix_points_.end());
+}
+
+int64 TSPTWDataDT::CompactMatrixIndex(int64 index) const {
+  if (index < 0)
+    return -1;
+  return std::lower_bound(matrix_points_.begin(), matrix_points_.end(), index) -
+         matrix_points_.begin();
+}
+
+void TSPTWDataDT::LoadSparseMatrix(const ortools_vrp::Problem& problem,
+                                   const ortools_vrp::Matrix& matrix) {
+  const int32 size                     = std::max<int32>(matrix_points_.size(), 3);
+  const int32 neighbour_size           = matrix.neighbour_size();
+  SparseGraphArcCost* const distances = new SparseGraphArcCost(size, neighbour_size);
+  SparseGraphArcCost* const times     = new SparseGraphArcCost(size, neighbour_size);
+  SparseGraphArcCost* const values    = new SparseGraphArcCost(size, neighbour_size);
+
+  double total_time     = 0;
+  double total_distance = 0;
+  for (std::size_t i = 0; i < matrix_points_.size(); ++i) {
+    const int64 first = static_cast<int64>(matrix_points_[i]) * neighbour_size;
+    int32 rank        = 0;
+    for (int64 n = first; n < std::min<int64>(first + neighbour_size, matrix.neighbours_size());
+         ++n) {
+      // Neighbours no service or vehicle refers to are dropped with the compaction
+      const int64 to = CompactMatrixIndex(matrix.neighbours(n));
+      if (to >= static_cast<int64>(matrix_points_.size()) ||
+          matrix_points_[to] != static_cast<int32>(matrix.neighbours(n)))
+        continue;
+      const RoutingIndexManager::NodeIndex from_node(i);
+      const RoutingIndexManager::NodeIndex to_node(to);
+      const int64 time =
+          n < matrix.neighbour_time_size() ? matrix.neighbour_time(n) + 0.5 : 0;
+      const int64 distance =
+          n < matrix.neighbour_distance_size() ? matrix.neighbour_distance(n) : 0;
+      times->SetNeighbour(from_node, rank, to_node, time);
+      distances->SetNeighbour(from_node, rank, to_node, distance);
+      values->SetNeighbour(from_node, rank, to_node,
+                           n < matrix.neighbour_value_size() ? matrix.neighbour_value(n) : 0);
+      if (time < CUSTOM_MAX_INT && distance < CUSTOM_MAX_INT) {
+        total_time += time;
+        total_distance += distance;
+      }
+      ++rank;
+    }
+  }
+
+  if (!matrix_points_.empty() && matrix_points_.back() < problem.points_size() &&
+      size == static_cast<int32>(matrix_points_.size())) {
+    std::vector<Point> points;
+    for (const int32 point : matrix_points_) {
+      points.push_back(
+          Point(problem.points(point).latitude(), problem.points(point).longitude()));
+    }
+    const double detour = matrix.detour_factor() > 0 ? matrix.detour_factor() : 1.0;
+    const double speed =
+        matrix.speed() > 0 ? matrix.speed()
+                           : (total_time > 0 ? total_distance / total_time : 0.0);
+    distances->SetPoints(points, detour);
+    if (speed > 0)
+      times->SetPoints(points, detour / speed);
+  }
+
+  times->SetIsInstanciated(CUSTOM_MAX_INT);
+  distances->SetIsInstanciated(CUSTOM_MAX_INT);
+  values->SetIsInstanciated(CUSTOM_MAX_INT);
+  max_time_     = std::max(max_time_, times->MaxCost());
+  max_distance_ = std::max(max_distance_, distances->MaxCost());
+  max_value_    = std::max(max_value_, values->MaxCost());
+
+  sparse_distances_matrices_.push_back(distances);
+  sparse_times_matrices_.push_back(times);
+  sparse_values_matrices_.push_back(values);
+  distances_matrices_.push_back(nullptr);
+  times_matrices_.push_back(nullptr);
+  values_matrices_.push_back(nullptr);
+}
+
+std::vector<RoutingIndexManager::NodeIndex>
+TSPTWDataDT::SparseNeighbours(RoutingIndexManager::NodeIndex node) const {
+  std::vector<RoutingIndexManager::NodeIndex> neighbours;
+  if (!IsSparse() || node.value() >= static_cast<int64>(matrix_indices_.size()) ||
+      matrix_indices_[node.value()] < 0)
+    return neighbours;
+  const int32 point = matrix_indices_[node.value()];
+  std::set<int32> points;
+  points.insert(point);
+  for (const SparseGraphArcCost* matrix : sparse_times_matrices_) {
+    if (matrix == nullptr)
+      continue;
+    for (int32 rank = 0; rank < matrix->NeighbourSize(); ++rank) {
+      const int32 neighbour = matrix->Neighbour(RoutingIndexManager::NodeIndex(point), rank);
+      if (neighbour >= 0)
+        points.insert(neighbour);
+    }
+  }
+  for (const int32 neighbour_point : points) {
+    for (const int32 neighbour : point_nodes_[neighbour_point]) {
+      if (neighbour != node.value())
+        neighbours.push_back(RoutingIndexManager::NodeIndex(neighbour));
+    }
+  }
+  return neighbours;
+}
+
+// Upper bound on the vehicles of a class of identical vehicles which could be used
+int32 TSPTWDataDT::UsefulVehicles(const ortools_vrp::Problem& problem,
+                                  int32 vehicle_index, int32 class_size) const {
+  const ortools_vrp::Vehicle& vehicle = problem.vehicles(vehicle_index);
+  std::set<int32> problem_indices;
+  std::vector<double> demands(vehicle.capacities_size(), 0);
+  std::vector<bool> refills(vehicle.capacities_size(), false);
+  double service_time = 0;
+  for (const ortools_vrp::Service& service : problem.services()) {
+    if (service.vehicle_indices_size() > 0 &&
+        std::find(service.vehicle_indices().begin(), service.vehicle_indices().end(),
+                  vehicle_index) == service.vehicle_indices().end())
+      continue;
+    // Alternatives are counted once
+    if (!problem_indices.insert(service.problem_index()).second)
+      continue;
+    for (int unit_i = 0;
+         unit_i < std::min(service.quantities_size(), vehicle.capacities_size());
+         ++unit_i) {
+      demands[unit_i] += std::abs(service.quantities(unit_i));
+      if (unit_i < service.refill_quantities_size() && service.refill_quantities(unit_i))
+        refills[unit_i] = true;
+    }
+    service_time +=
+        vehicle.coef_service() * service.duration() + vehicle.additional_service();
+  }
+
+  // Every used vehicle serves at least one service
+  int64 useful = std::min<int64>(class_size, std::max<int64>(problem_indices.size(), 1));
+  if (FLAGS_vehicle_limit > 0)
+    useful = std::min<int64>(useful, FLAGS_vehicle_limit);
+
+  if (FLAGS_fleet_reduction_ratio > 0) {
+    double needed = 1;
+    for (int unit_i = 0; unit_i < vehicle.capacities_size(); ++unit_i) {
+      const ortools_vrp::Capacity& capacity = vehicle.capacities(unit_i);
+      if (capacity.limit() > 0 && capacity.overload_multiplier() == 0 && !refills[unit_i])
+        needed = std::max(needed, demands[unit_i] / capacity.limit());
+    }
+    int64 shift = vehicle.time_window().end() > vehicle.time_window().start()
+                      ? vehicle.time_window().end() - vehicle.time_window().start()
+                      : 0;
+    if (vehicle.duration() > 0)
+      shift = shift > 0 ? std::min(shift, vehicle.duration()) : vehicle.duration();
+    if (shift > 0)
+      needed = std::max(needed, service_time / shift);
+    useful = std::min<int64>(
+        useful, std::max<int64>(std::ceil(FLAGS_fleet_reduction_ratio * needed), 1));
+  }
+  return useful;
+}
+
+// Vehicles are identical when they only differ by their ids and the same services
+// list them. Vehicles given an initial route or named by a relation are not
+// interchangeable and get an empty fingerprint.
+std::vector<std::string>
+TSPTWDataDT::VehicleFingerprints(const ortools_vrp::Problem& problem) const {
+  const int32 size_vehicles = problem.vehicles_size();
+  std::vector<std::vector<int32>> vehicle_services(size_vehicles);
+  for (int32 s = 0; s < problem.services_size(); ++s) {
+    for (const int32 v : problem.services(s).vehicle_indices()) {
+      if (v >= 0 && v < size_vehicles)
+        vehicle_services[v].push_back(s);
+    }
+  }
+
+  std::set<std::string> referenced_ids;
+  for (const ortools_vrp::Route& route : problem.routes())
+    referenced_ids.insert(route.vehicle_id());
+  for (const ortools_vrp::Relation& relation : problem.relations()) {
+    for (const std::string& vehicle_id : relation.linked_vehicle_ids())
+      referenced_ids.insert(vehicle_id);
+  }
+
+  std::vector<std::string> fingerprints(size_vehicles);
+  for (int32 v = 0; v < size_vehicles; ++v) {
+    if (referenced_ids.count(problem.vehicles(v).id()))
+      continue;
+    ortools_vrp::Vehicle vehicle(problem.vehicles(v));
+    vehicle.clear_id();
+    for (ortools_vrp::Rest& rest : *vehicle.mutable_rests())
+      rest.clear_id();
+    vehicle.SerializeToString(&fingerprints[v]);
+    for (const int32 s : vehicle_services[v])
+      fingerprints[v] += "/" + std::to_string(s);
+  }
+  return fingerprints;
+}
+
+// Only the useful vehicles of each class of identical vehicles are kept
+void TSPTWDataDT::ReduceFleet(ortools_vrp::Problem* problem) {
+  const int32 size_vehicles = problem->vehicles_size();
+  const std::vector<std::string> fingerprints = VehicleFingerprints(*problem);
+  std::map<std::string, std::vector<int32>> classes;
+  for (int32 v = 0; v < size_vehicles; ++v) {
+    if (!fingerprints[v].empty())
+      classes[fingerprints[v]].push_back(v);
+  }
+
+  std::vector<bool> kept(size_vehicles, true);
+  bool reduced = false;
+  for (const auto& vehicle_class : classes) {
+    const std::vector<int32>& vehicles = vehicle_class.second;
+    for (std::size_t i = UsefulVehicles(*problem, vehicles[0], vehicles.size());
+         i < vehicles.size(); ++i) {
+      kept[vehicles[i]] = false;
+      reduced           = true;
+    }
+  }
+  if (!reduced)
+    return;
+
+  std::vector<int32> new_indices(size_vehicles, -1);
+  google::protobuf::RepeatedPtrField<ortools_vrp::Vehicle> vehicles;
+  vehicles.Swap(problem->mutable_vehicles());
+  for (int32 v = 0; v < size_vehicles; ++v) {
+    if (kept[v]) {
+      new_indices[v] = problem->vehicles_size();
+      vehicle_positions_.push_back(v);
+      problem->add_vehicles()->Swap(vehicles.Mutable(v));
+    } else {
+      removed_vehicles_[v] = vehicles.Get(v).time_window().start();
+    }
+  }
+  // Services listing a removed vehicle also list the kept ones of its class
+  for (ortools_vrp::Service& service : *problem->mutable_services()) {
+    google::protobuf::RepeatedField<int32> vehicle_indices;
+    vehicle_indices.Swap(service.mutable_vehicle_indices());
+    for (const int32 v : vehicle_indices) {
+      if (v < 0 || v >= size_vehicles)
+        service.add_vehicle_indices(v);
+      else if (new_indices[v] != -1)
+        service.add_vehicle_indices(new_indices[v]);
+    }
+  }
+}
+
 void TSPTWDataDT::LoadInstance(const std::string& filename) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
 
@@ -695,15 +1371,50 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
     }
   }
 
+  LoadPresolvedProblem(&problem);
+}
+
+void TSPTWDataDT::LoadPresolvedProblem(ortools_vrp::Problem* problem) {
+  if (FLAGS_reduce_fleet)
+    ReduceFleet(problem);
+  LoadProblem(*problem);
+}
+
+void TSPTWDataDT::LoadProblem(const ortools_vrp::Problem& problem) {
   int32 node_index      = 0;
   tws_counter_          = 0;
   multiple_tws_counter_ = 0;
+  merged_tws_counter_   = 0;
   deliveries_counter_   = 0;
   int32 matrix_index    = 0;
   order_counter_        = 0;
   size_problem_         = 0;
   std::vector<int64> matrix_indices;
+  const std::set<std::string> infeasible_ids = FLAGS_presolve_infeasible_services
+                                                   ? InfeasibleServices(problem)
+                                                   : std::set<std::string>();
+  std::map<std::string, std::vector<const ortools_vrp::Service*>> aggregations;
+  if (FLAGS_aggregate_services)
+    aggregations = AggregateServices(problem, infeasible_ids);
+  std::set<std::string> aggregated_ids;
+  float max_coef_service = 0;
+  for (const ortools_vrp::Vehicle& vehicle : problem.vehicles())
+    max_coef_service = std::max(max_coef_service, vehicle.coef_service());
+  for (const auto& aggregation : aggregations) {
+    for (const ortools_vrp::Service* service : aggregation.second) {
+      if (service->id() != aggregation.first)
+        aggregated_ids.insert(service->id());
+    }
+  }
+
   for (const ortools_vrp::Service& service : problem.services()) {
+    if (infeasible_ids.count(service.id())) {
+      infeasible_service_ids_.push_back(service.id());
+      continue;
+    }
+    // Carried by the node of the first service of its location
+    if (aggregated_ids.count(service.id()))
+      continue;
     if (!alternative_size_map_.count(service.problem_index()))
       alternative_size_map_[service.problem_index()] = 0;
     const int32 tws_size = service.time_windows_size();
@@ -720,6 +1431,28 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
       q.push_back(quantity);
     }
 
+    int64 duration         = service.duration();
+    int64 additional_value = service.additional_value();
+    int64 due_shift        = 0;
+    std::vector<AggregatedService> aggregated_services;
+    if (aggregations.count(service.id())) {
+      duration         = 0;
+      additional_value = 0;
+      std::fill(q.begin(), q.end(), 0);
+      for (const ortools_vrp::Service* aggregated : aggregations.at(service.id())) {
+        duration += aggregated->duration();
+        additional_value += aggregated->additional_value();
+        std::vector<int64> aggregated_q(aggregated->quantities().begin(),
+                                        aggregated->quantities().end());
+        for (std::size_t unit_i = 0; unit_i < q.size(); ++unit_i)
+          q[unit_i] += aggregated_q[unit_i];
+        aggregated_services.push_back(
+            AggregatedService(aggregated->id(), aggregated->problem_index(),
+                              aggregated->duration(), aggregated_q));
+      }
+      due_shift = AggregatedDueShift(aggregations.at(service.id()), max_coef_service);
+    }
+
     std::vector<int64> s_q;
     for (const int64& setup_quantity : service.setup_quantities()) {
       s_q.push_back(setup_quantity);
@@ -741,7 +1474,7 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
     for (const ortools_vrp::TimeWindow* timewindow : timewindows) {
       timewindow->start() > -CUSTOM_MAX_INT ? ready_time.push_back(timewindow->start())
                                             : ready_time.push_back(-CUSTOM_MAX_INT);
-      timewindow->end() < CUSTOM_MAX_INT ? due_time.push_back(timewindow->end())
+      timewindow->end() < CUSTOM_MAX_INT ? due_time.push_back(timewindow->end() - due_shift)
                                          : due_time.push_back(CUSTOM_MAX_INT);
     }
     tws_counter_ += timewindows.size();
@@ -749,9 +1482,16 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
     if (timewindows.size() > 1)
       multiple_tws_counter_ += 1;
 
-    int timewindow_index = 0;
+    std::size_t timewindow_index = 0;
+
+    // Each soft time window becomes an alternative node, unless the windows
+    // share a single node whose lateness is counted over their union
+    const bool tws_union = service.late_multiplier() > 0 &&
+                           FLAGS_soft_time_windows_union && timewindows.size() > 1;
+    if (tws_union)
+      merged_tws_counter_ += timewindows.size() - 1;
 
-    if (service.late_multiplier() > 0) {
+    if (service.late_multiplier() > 0 && !tws_union) {
       do {
         matrix_indices.push_back(service.matrix_index());
         std::vector<int64> start;
@@ -782,19 +1522,20 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
         ids_map_[(std::string)service.id()] = node_index;
         node_index++;
         ++timewindow_index;
-      } while (timewindow_index < service.time_windows_size());
+      } while (timewindow_index < timewindows.size());
     } else {
       matrix_indices.push_back(service.matrix_index());
       size_problem_ = std::max(size_problem_, service.problem_index());
       tsptw_clients_.push_back(TSPTWClient(
           (std::string)service.id(), matrix_index, service.problem_index(),
           alternative_size_map_[service.problem_index()], ready_time, due_time,
-          service.duration(), service.additional_value(), service.setup_duration(),
+          duration, additional_value, service.setup_duration(),
           service.priority(),
           timewindows.size() > 0 ? (int64)(service.late_multiplier() * CUSTOM_BIGNUM) : 0, v_i,
           q, s_q, service.exclusion_cost() > 0 ? service.exclusion_cost() * CUSTOM_BIGNUM : -1,
           r_q));
-      service_times_.push_back(service.duration());
+      tsptw_clients_.back().aggregated_services = aggregated_services;
+      service_times_.push_back(duration);
       alternative_size_map_[service.problem_index()] += 1;
       ids_map_[(std::string)service.id()] = node_index;
       node_index++;
@@ -820,12 +1561,22 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
   max_distance_cost_ = 0;
   max_value_cost_    = 0;
 
+  CompactMatrixPoints(problem);
+  matrix_indices_.clear();
+  for (const int64 index : matrix_indices) {
+    matrix_indices_.push_back(CompactMatrixIndex(index));
+  }
+
   for (const ortools_vrp::Matrix& matrix : problem.matrices()) {
-    // + 2 In case vehicles have no depots
-    int32 problem_size =
-        std::max(std::max(sqrt(matrix.distance_size()), sqrt(matrix.time_size())),
-                 sqrt(matrix.value_size())) +
-        2 + (size_rest_ > 0 ? 1 : 0);
+    if (matrix.neighbour_size() > 0) {
+      LoadSparseMatrix(problem, matrix);
+      continue;
+    }
+    sparse_distances_matrices_.push_back(nullptr);
+    sparse_times_matrices_.push_back(nullptr);
+    sparse_values_matrices_.push_back(nullptr);
+
+    const int32 problem_size = matrix_points_.size();
     CompleteGraphArcCost* distances = new CompleteGraphArcCost();
     distances->Create(std::max(problem_size, 3));
     CompleteGraphArcCost* times = new CompleteGraphArcCost();
@@ -846,28 +1597,38 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
       }
     }
 
-    if (matrix.time_size() > 0) {
-      max_time_ = std::max(max_time_, BuildTimeMatrix(matrix));
-    }
-
-    if (matrix.distance_size() > 0) {
-      max_distance_ = std::max(max_distance_, BuildDistanceMatrix(matrix));
-    }
+    if (matrix.time_size() > 0)
+      BuildTimeMatrix(matrix);
+    if (matrix.distance_size() > 0)
+      BuildDistanceMatrix(matrix);
+    if (matrix.value_size() > 0)
+      BuildValueMatrix(matrix);
+
+    // Packs symmetric matrices and computes their extreme costs
+    times->SetIsInstanciated(true, CUSTOM_MAX_INT);
+    distances->SetIsInstanciated(true, CUSTOM_MAX_INT);
+    values->SetIsInstanciated(true, CUSTOM_MAX_INT);
+    max_time_     = std::max(max_time_, times->MaxCost());
+    max_distance_ = std::max(max_distance_, distances->MaxCost());
+    max_value_    = std::max(max_value_, values->MaxCost());
+  }
 
-    if (matrix.value_size() > 0) {
-      max_value_ = std::max(max_value_, BuildValueMatrix(matrix));
+  point_nodes_.clear();
+  if (IsSparse()) {
+    point_nodes_.resize(matrix_points_.size());
+    for (std::size_t node = 0; node < matrix_indices_.size(); ++node) {
+      if (matrix_indices_[node] >= 0)
+        point_nodes_[matrix_indices_[node]].push_back(node);
     }
   }
 
-  int64 current_day_index        = 0;
-  int v_idx                      = 0;
-  day_index_to_vehicle_index_[0] = v_idx;
+  const std::vector<std::string> fingerprints = VehicleFingerprints(problem);
+  std::map<std::string, int32> symmetry_classes;
+
+  int v_idx = 0;
+  day_first_vehicles_.assign(1, v_idx);
   for (const ortools_vrp::Vehicle& vehicle : problem.vehicles()) {
     Vehicle* v = new Vehicle(this, size_);
-    // Every vehicle has its own matrix definition
-    std::vector<int64> vehicle_indices(matrix_indices);
-    vehicle_indices.push_back(vehicle.start_index());
-    vehicle_indices.push_back(vehicle.end_index());
 
     for (const ortools_vrp::Capacity& capacity : vehicle.capacities()) {
       v->capacity.push_back(capacity.limit());
@@ -880,7 +1641,14 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
     v->break_size           = vehicle.rests().size();
     v->problem_matrix_index = vehicle.matrix_index();
     v->value_matrix_index   = vehicle.value_matrix_index();
-    v->vehicle_indices      = vehicle_indices;
+    v->start_matrix_index   = CompactMatrixIndex(vehicle.start_index());
+    v->end_matrix_index     = CompactMatrixIndex(vehicle.end_index());
+    if (!fingerprints[v_idx].empty()) {
+      const int32 symmetry_class = symmetry_classes.size();
+      v->symmetry_class =
+          symmetry_classes.insert(std::make_pair(fingerprints[v_idx], symmetry_class))
+              .first->second;
+    }
     v->time_start           = vehicle.time_window().start() > -CUSTOM_MAX_INT
                         ? vehicle.time_window().start()
                         : -CUSTOM_MAX_INT;
@@ -919,12 +1687,8 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
 
     tsptw_vehicles_.push_back(v);
     vehicle_ids_map_[(std::string)vehicle.id()] = v_idx;
-    if (current_day_index < vehicle.day_index()) {
-      do {
-        ++current_day_index;
-        day_index_to_vehicle_index_[current_day_index] = v_idx;
-      } while (current_day_index < vehicle.day_index());
-    }
+    while (static_cast<int64>(day_first_vehicles_.size()) <= vehicle.day_index())
+      day_first_vehicles_.push_back(v_idx);
 
     // Add vehicle rests
     for (const ortools_vrp::Rest& rest : vehicle.rests()) {
@@ -1045,6 +1809,81 @@ void TSPTWDataDT::LoadInstance(const std::string& filename) {
     horizon_ = std::max(horizon_, tsptw_vehicles_.at(v)->time_end);
   }
   max_rest_ = 0;
+
+  if (FLAGS_matrix_reordering)
+    ReorderMatrices();
+}
+
+namespace {
+CompleteGraphArcCost* PermuteMatrix(const CompleteGraphArcCost* matrix,
+                                    const std::vector<int32>& new_indices) {
+  CompleteGraphArcCost* permuted = new CompleteGraphArcCost(matrix->Size());
+  for (RoutingIndexManager::NodeIndex i(0); i < matrix->Size(); ++i) {
+    for (RoutingIndexManager::NodeIndex j(0); j < matrix->Size(); ++j) {
+      permuted->Cost(RoutingIndexManager::NodeIndex(new_indices[i.value()]),
+                     RoutingIndexManager::NodeIndex(new_indices[j.value()])) =
+          matrix->Cost(i, j);
+    }
+  }
+  return permuted;
+}
+} // namespace
+
+// Points close in time get close matrix indices, so the rows read by the transit
+// callbacks of neighbouring nodes share cache lines. Results only refer to problem
+// indices, nothing has to be restored.
+void TSPTWDataDT::ReorderMatrices() {
+  if (times_matrices_.empty() || IsSparse())
+    return;
+  const int32 size = times_matrices_[0]->Size();
+  for (std::vector<CompleteGraphArcCost*>* matrices :
+       {&distances_matrices_, &times_matrices_, &values_matrices_}) {
+    for (CompleteGraphArcCost* matrix : *matrices) {
+      if (matrix->Size() != size)
+        return;
+    }
+  }
+
+  // Greedy nearest neighbour chain over the first time matrix
+  const CompleteGraphArcCost* times = times_matrices_[0];
+  std::vector<int32> new_indices(size, -1);
+  int32 current = 0;
+  for (int32 rank = 0; rank < size; ++rank) {
+    new_indices[current] = rank;
+    int32 closest        = -1;
+    int64 closest_time   = kint64max;
+    for (int32 j = 0; j < size; ++j) {
+      const int64 time = times->Cost(RoutingIndexManager::NodeIndex(current),
+                                     RoutingIndexManager::NodeIndex(j));
+      if (new_indices[j] == -1 && time < closest_time) {
+        closest      = j;
+        closest_time = time;
+      }
+    }
+    if (closest == -1)
+      break;
+    current = closest;
+  }
+
+  for (std::vector<CompleteGraphArcCost*>* matrices :
+       {&distances_matrices_, &times_matrices_, &values_matrices_}) {
+    for (CompleteGraphArcCost*& matrix : *matrices) {
+      CompleteGraphArcCost* permuted = PermuteMatrix(matrix, new_indices);
+      permuted->SetIsInstanciated(true, CUSTOM_MAX_INT);
+      delete matrix;
+      matrix = permuted;
+    }
+  }
+  for (int32& matrix_index : matrix_indices_) {
+    if (matrix_index >= 0 && matrix_index < size)
+      matrix_index = new_indices[matrix_index];
+  }
+  for (Vehicle* v : tsptw_vehicles_) {
+    if (v->start_matrix_index >= 0 && v->start_matrix_index < size)
+      v->start_matrix_index = new_indices[v->start_matrix_index];
+    if (v->end_matrix_index >= 0 && v->end_matrix_index < size)
+      v->end_matrix_index = new_indices[v->end_matrix_index];
+  }
 }
 
 } //  namespace operations_research